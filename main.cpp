@@ -1,248 +1,4236 @@
-#include <QCoreApplication>
-#include <iostream>
-#include <vector>
-#include <cstddef>
-#include <sstream>
-#include <string>
-
-// ====================== 1. Prototype ======================
-class GraphObject {
-protected:
-    bool isColored;
-
-public:
-    GraphObject(bool colored = true) : isColored(colored) {}
-    virtual ~GraphObject() = default;
-
-    virtual GraphObject* clone() const = 0;
-    virtual void draw() const = 0;
-    virtual size_t memorySize() const = 0;
-
-    bool getColor() const { return isColored; }
-};
-
-class Point : public GraphObject {
-    double x, y;
-public:
-    Point(double x = 0, double y = 0, bool colored = true)
-        : GraphObject(colored), x(x), y(y) {}
-    GraphObject* clone() const override { return new Point(*this); }
-    void draw() const override {
-        std::cout << (isColored ? "Color" : "B/W") << " Point (" << x << ", " << y << ")\n";
-    }
-    size_t memorySize() const override { return sizeof(Point); }
-};
-
-class Line : public GraphObject {
-    double x1, y1, x2, y2;
-public:
-    Line(double x1=0, double y1=0, double x2=0, double y2=0, bool colored=true)
-        : GraphObject(colored), x1(x1), y1(y1), x2(x2), y2(y2) {}
-    GraphObject* clone() const override { return new Line(*this); }
-    void draw() const override {
-        std::cout << (isColored ? "Color" : "B/W") << " Line (" << x1 << "," << y1
-                  << ")-(" << x2 << "," << y2 << ")\n";
-    }
-    size_t memorySize() const override { return sizeof(Line); }
-};
-
-class Circle : public GraphObject {
-    double cx, cy, r;
-public:
-    Circle(double cx=0, double cy=0, double r=1, bool colored=true)
-        : GraphObject(colored), cx(cx), cy(cy), r(r) {}
-    GraphObject* clone() const override { return new Circle(*this); }
-    void draw() const override {
-        std::cout << (isColored ? "Color" : "B/W") << " Circle (" << cx << "," << cy << ") r=" << r << "\n";
-    }
-    size_t memorySize() const override { return sizeof(Circle); }
-};
-
-// ====================== 2. Singleton ======================
-class Scene {
-private:
-    static Scene* instance;
-    std::vector<GraphObject*> objects;
-    Scene() = default;
-public:
-    static Scene* getInstance() {
-        if (!instance) instance = new Scene();
-        return instance;
-    }
-    void addObject(GraphObject* obj) {
-        if (obj) objects.push_back(obj);
-    }
-    void drawAll() const {
-        std::cout << "=== What the scene contains ===\n";
-        for (const auto* obj : objects) obj->draw();
-        std::cout << "========================\n\n";
-    }
-    void clear() {
-        for (auto* obj : objects) delete obj;
-        objects.clear();
-    }
-    ~Scene() { clear(); }
-};
-Scene* Scene::instance = nullptr;
-
-// ====================== 3. Abstract Factory ======================
-class AbstractGraphFactory {
-public:
-    virtual ~AbstractGraphFactory() = default;
-    virtual GraphObject* createPoint(double x = 0, double y = 0) = 0;
-    virtual GraphObject* createLine(double x1=0, double y1=0, double x2=0, double y2=0) = 0;
-    virtual GraphObject* createCircle(double cx=0, double cy=0, double r=1) = 0;
-};
-
-class ColorGraphFactory : public AbstractGraphFactory {
-public:
-    GraphObject* createPoint(double x = 0, double y = 0) override {
-        auto* p = new Point(x, y, true); Scene::getInstance()->addObject(p); return p;
-    }
-    GraphObject* createLine(double x1=0, double y1=0, double x2=0, double y2=0) override {
-        auto* l = new Line(x1,y1,x2,y2,true); Scene::getInstance()->addObject(l); return l;
-    }
-    GraphObject* createCircle(double cx=0, double cy=0, double r=1) override {
-        auto* c = new Circle(cx,cy,r,true); Scene::getInstance()->addObject(c); return c;
-    }
-};
-
-// ====================== 4. Making Adapter(Wrapper) ======================
-class ThirdPartyTriangle {
-    double x1,y1,x2,y2,x3,y3;
-public:
-    ThirdPartyTriangle(double a1=0,double b1=0,double a2=0,double b2=0,double a3=0,double b3=0)
-        : x1(a1),y1(b1),x2(a2),y2(b2),x3(a3),y3(b3) {}
-    void render() const {
-        std::cout << "Third-Party Triangle (" << x1 << "," << y1 << ") (" << x2 << "," << y2
-                  << ") (" << x3 << "," << y3 << ")\n";
-    }
-};
-
-class TriangleAdapter : public GraphObject {
-    ThirdPartyTriangle* triangle;
-public:
-    TriangleAdapter(double x1=0, double y1=0, double x2=0, double y2=0, double x3=0, double y3=0, bool colored=true)
-        : GraphObject(colored) {
-        triangle = new ThirdPartyTriangle(x1,y1,x2,y2,x3,y3);
-    }
-    ~TriangleAdapter() override { delete triangle; }
-    GraphObject* clone() const override { return new TriangleAdapter(*this); }
-    void draw() const override {
-        std::cout << (isColored ? "Color" : "B/W") << " ";
-        triangle->render();
-    }
-    size_t memorySize() const override { return sizeof(TriangleAdapter); }
-};
-
-// ====================== 5. Making Composite ======================
-class Composite : public GraphObject {
-    std::vector<GraphObject*> children;
-public:
-    Composite(bool colored = true) : GraphObject(colored) {}
-    ~Composite() override {
-        for (auto* child : children) delete child;
-    }
-    void add(GraphObject* g) { if (g) children.push_back(g); }
-    GraphObject* clone() const override {
-        auto* copy = new Composite(isColored);
-        for (auto* child : children) copy->add(child->clone());
-        return copy;
-    }
-    void draw() const override {
-        std::cout << "Composite (contains " << children.size() << " elements):\n";
-        for (auto* child : children) child->draw();
-    }
-    size_t memorySize() const override { return sizeof(Composite); }
-};
-
-// ====================== 6. Making Decorator (triangle coloring) ======================
-class FilledDecorator : public GraphObject {
-    GraphObject* component;
-public:
-    FilledDecorator(GraphObject* c)
-        : GraphObject(c->getColor()), component(c) {}
-    ~FilledDecorator() override { delete component; }
-    GraphObject* clone() const override { return new FilledDecorator(component->clone()); }
-    void draw() const override {
-        component->draw();
-        std::cout << "   >>> This graphic object is filled! <<<\n";
-    }
-    size_t memorySize() const override { return sizeof(FilledDecorator); }
-};
-
-// ====================== 7. Making Facade ======================
-class GraphicsFacade {
-    AbstractGraphFactory* factory;
-public:
-    GraphicsFacade(AbstractGraphFactory* f) : factory(f) {}
-
-    void buildSceneFromString(const std::string& command) {
-        Scene::getInstance()->clear();
-        std::istringstream iss(command);
-        std::string token;
-        GraphObject* pendingTriangle = nullptr;
-
-        while (std::getline(iss, token, ';')) {
-            token.erase(0, token.find_first_not_of(" \t"));
-            if (token.empty()) continue;
-
-            std::istringstream tss(token);
-            char type;
-            tss >> type;
-
-            if (type == 'P' || type == 'p') {       // Point
-                double x, y; char comma;
-                tss >> x >> comma >> y;
-                factory->createPoint(x, y);
-            }
-            else if (type == 'C' || type == 'c') {  // Circle
-                double cx, cy, r; char c1, c2;
-                tss >> cx >> c1 >> cy >> c2 >> r;
-                factory->createCircle(cx, cy, r);
-            }
-            else if (type == 'T' || type == 't') {  // Triangle
-                double x1,y1,x2,y2,x3,y3; char c1,c2,c3,c4,c5;
-                tss >> x1 >> c1 >> y1 >> c2 >> x2 >> c3 >> y2 >> c4 >> x3 >> c5 >> y3;
-                pendingTriangle = new TriangleAdapter(x1,y1,x2,y2,x3,y3,true);
-            }
-            else if (type == 'F' || type == 'f') {  // Color filling for the triangle
-                if (pendingTriangle) {
-                    GraphObject* filled = new FilledDecorator(pendingTriangle);
-                    Scene::getInstance()->addObject(filled);
-                    pendingTriangle = nullptr;
-                }
-            }
-        }
-
-        // If there is no F — regular triangle
-        if (pendingTriangle) {
-            Scene::getInstance()->addObject(pendingTriangle);
-        }
-    }
-};
-
-// ====================== main ======================
-int main(int argc, char *argv[])
-{
-    QCoreApplication a(argc, argv);
-
-    ColorGraphFactory colorFactory;
-    GraphicsFacade facade(&colorFactory);
-
-    // Facade demonstration
-    std::string command = "P 10,20; C 50,50,25; T 0,0,100,0,50,80; F";
-    std::cout << "Facade query-string: " << command << "\n\n";
-    facade.buildSceneFromString(command);
-    Scene::getInstance()->drawAll();
-
-    // === Composite demonstration ===
-    std::cout << "=== Composite demonstration ===\n";
-    Composite* group = new Composite();
-    group->add(new Point(1,1,true));
-    group->add(new Circle(5,5,10,true));
-    group->draw();
-    delete group;
-
-    return a.exec();
-}
+#include <QCoreApplication>
+#include <iostream>
+#include <vector>
+#include <cstddef>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <numeric>
+#include <functional>
+#include <charconv>
+#include <cstring>
+#include <cctype>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __unix__
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <csignal>
+#include <cerrno>
+#include <ucontext.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#endif
+
+// ====================== 0. Geometry: bounds, shape sink, raster ======================
+struct Bounds {
+    double minX, minY, maxX, maxY;
+    Bounds()
+        : minX(std::numeric_limits<double>::infinity()), minY(std::numeric_limits<double>::infinity()),
+          maxX(-std::numeric_limits<double>::infinity()), maxY(-std::numeric_limits<double>::infinity()) {}
+    Bounds(double x1, double y1, double x2, double y2)
+        : minX(std::min(x1, x2)), minY(std::min(y1, y2)), maxX(std::max(x1, x2)), maxY(std::max(y1, y2)) {}
+
+    bool empty() const { return minX > maxX || minY > maxY; }
+    void expand(double x, double y) {
+        minX = std::min(minX, x); minY = std::min(minY, y);
+        maxX = std::max(maxX, x); maxY = std::max(maxY, y);
+    }
+    void expand(const Bounds& b) {
+        if (b.empty()) return;
+        expand(b.minX, b.minY); expand(b.maxX, b.maxY);
+    }
+    bool intersects(const Bounds& b) const {
+        return !empty() && !b.empty() && minX <= b.maxX && b.minX <= maxX && minY <= b.maxY && b.minY <= maxY;
+    }
+};
+
+// Receives the primitive geometry of graphic objects (raster, exporters, ...)
+class ShapeSink {
+public:
+    virtual ~ShapeSink() = default;
+    virtual void point(double x, double y, bool colored) = 0;
+    virtual void line(double x1, double y1, double x2, double y2, bool colored) = 0;
+    virtual void circle(double cx, double cy, double r, bool colored) = 0;
+    virtual void triangle(const double* v, bool colored) = 0;    // x1,y1,x2,y2,x3,y3
+    virtual void triangles(const double* v, size_t count, bool colored) {
+        for (size_t i = 0; i < count; ++i) triangle(v + 6 * i, colored);
+    }
+    // n vertices as x,y pairs; closed adds the edge back to the first vertex
+    virtual void polyline(const double* xy, size_t n, bool closed, bool colored) {
+        for (size_t i = 1; i < n; ++i) line(xy[2 * i - 2], xy[2 * i - 1], xy[2 * i], xy[2 * i + 1], colored);
+        if (closed && n > 2) line(xy[2 * n - 2], xy[2 * n - 1], xy[0], xy[1], colored);
+    }
+    virtual void beginFill() {}
+    virtual void endFill() {}
+    virtual void beginGroup() {}
+    virtual void endGroup() {}
+};
+
+// Hard: one sample per pixel; Supersample4x4: 16 samples; Analytic: coverage from edge distance
+enum class RasterQuality { Hard, Supersample4x4, Analytic };
+
+inline const char* qualityName(RasterQuality q) {
+    return q == RasterQuality::Hard ? "hard" : q == RasterQuality::Supersample4x4 ? "4x4 supersample" : "analytic";
+}
+
+// Per-frame counters of the raster path
+struct FrameStats {
+    size_t drawn = 0, culledViewport = 0, culledOccluded = 0;
+    size_t pixelsWritten = 0, pixelsRejected = 0, pixelsCovered = 0;
+    double overdraw() const { return pixelsCovered ? double(pixelsWritten) / pixelsCovered : 0.0; }
+};
+
+// 8-bit coverage raster over a world-space viewport
+class Raster : public ShapeSink {
+    static constexpr int kBlock = 8;
+    int w, h;
+    Bounds view;
+    double sx, sy;              // pixels per world unit
+    int fillDepth = 0;
+    RasterQuality quality = RasterQuality::Hard;
+    std::vector<unsigned char> pixels;
+    std::vector<float> span;    // coverage of the current row span
+
+    // Occlusion (front-to-back drawing): fully covered filled pixels are opaque and
+    // reject later writes; blockOpaque counts opaque pixels per kBlock x kBlock block
+    bool occlusion = false;
+    std::vector<unsigned char> opaque;
+    std::vector<int> blockOpaque;
+    size_t written = 0, rejected = 0;
+
+    int blocksX() const { return (w + kBlock - 1) / kBlock; }
+    int blockCapacity(int bx, int by) const {
+        return (std::min(w, (bx + 1) * kBlock) - bx * kBlock) * (std::min(h, (by + 1) * kBlock) - by * kBlock);
+    }
+    void write(int px, int py, unsigned char v, bool solid) {
+        size_t idx = size_t(py) * w + px;
+        if (!occlusion) { if (v > pixels[idx]) pixels[idx] = v; return; }
+        if (!v) return;
+        if (opaque[idx]) { ++rejected; return; }
+        ++written;
+        if (v > pixels[idx]) pixels[idx] = v;
+        if (solid && v == 255) {
+            opaque[idx] = 1;
+            ++blockOpaque[size_t(py / kBlock) * blocksX() + px / kBlock];
+        }
+    }
+
+    double toPx(double x) const { return (x - view.minX) * sx; }
+    double toPy(double y) const { return (y - view.minY) * sy; }
+    static double clamp01(double v) { return v < 0 ? 0 : v > 1 ? 1 : v; }
+    void set(int px, int py, unsigned char v) {
+        if (px < 0 || py < 0 || px >= w || py >= h) return;
+        write(px, py, v, false);
+    }
+    void plotPx(double px, double py) { set(int(std::floor(px)), int(std::floor(py)), 255); }
+    void linePx(double x1, double y1, double x2, double y2) {
+        int steps = int(std::ceil(std::max(std::fabs(x2 - x1), std::fabs(y2 - y1))));
+        for (int i = 0; i <= steps; ++i) {
+            double t = steps ? double(i) / steps : 0.0;
+            plotPx(x1 + (x2 - x1) * t, y1 + (y2 - y1) * t);
+        }
+    }
+    // Signed distances in pixels to a shape edge, negative inside, for coverSpan. Each takes
+    // one sample point or, with SSE2, two of them in the lanes of an __m128d.
+    struct CircleDist {
+        double cx, cy, rx, ry, rmin;
+        double operator()(double qx, double qy) const {
+            double dx = (qx - cx) / rx, dy = (qy - cy) / ry;
+            return (std::sqrt(dx * dx + dy * dy) - 1.0) * rmin;
+        }
+#ifdef __SSE2__
+        __m128d operator()(__m128d qx, __m128d qy) const {
+            __m128d dx = _mm_div_pd(_mm_sub_pd(qx, _mm_set1_pd(cx)), _mm_set1_pd(rx));
+            __m128d dy = _mm_div_pd(_mm_sub_pd(qy, _mm_set1_pd(cy)), _mm_set1_pd(ry));
+            __m128d len = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)));
+            return _mm_mul_pd(_mm_sub_pd(len, _mm_set1_pd(1.0)), _mm_set1_pd(rmin));
+        }
+#endif
+    };
+    // Filled triangle: edge functions scaled to pixel distance, positive inside
+    struct TriangleDist {
+        double ax, ay, bx, by, cx, cy, l0, l1, l2;
+        double operator()(double qx, double qy) const {
+            double e0 = l0 * ((bx - ax) * (qy - ay) - (by - ay) * (qx - ax));
+            double e1 = l1 * ((cx - bx) * (qy - by) - (cy - by) * (qx - bx));
+            double e2 = l2 * ((ax - cx) * (qy - cy) - (ay - cy) * (qx - cx));
+            return -std::min(e0, std::min(e1, e2));
+        }
+#ifdef __SSE2__
+        static __m128d edge(double l, double ux, double uy, double vx, double vy, __m128d qx, __m128d qy) {
+            __m128d a = _mm_mul_pd(_mm_set1_pd(vx - ux), _mm_sub_pd(qy, _mm_set1_pd(uy)));
+            __m128d b = _mm_mul_pd(_mm_set1_pd(vy - uy), _mm_sub_pd(qx, _mm_set1_pd(ux)));
+            return _mm_mul_pd(_mm_set1_pd(l), _mm_sub_pd(a, b));
+        }
+        __m128d operator()(__m128d qx, __m128d qy) const {
+            __m128d e = _mm_min_pd(edge(l0, ax, ay, bx, by, qx, qy),
+                                   _mm_min_pd(edge(l1, bx, by, cx, cy, qx, qy), edge(l2, cx, cy, ax, ay, qx, qy)));
+            return _mm_sub_pd(_mm_setzero_pd(), e);
+        }
+#endif
+    };
+    // Triangle outline: distance to the nearest of the three edge segments
+    struct OutlineDist {
+        double ux[3], uy[3], dx[3], dy[3], inv[3];     // segment start, direction, 1 / length^2 (0 if empty)
+        OutlineDist(double ax, double ay, double bx, double by, double cx, double cy) {
+            const double px[4] = {ax, bx, cx, ax}, py[4] = {ay, by, cy, ay};
+            for (int k = 0; k < 3; ++k) {
+                ux[k] = px[k]; uy[k] = py[k];
+                dx[k] = px[k + 1] - px[k]; dy[k] = py[k + 1] - py[k];
+                double len2 = dx[k] * dx[k] + dy[k] * dy[k];
+                inv[k] = len2 > 0 ? 1.0 / len2 : 0.0;
+            }
+        }
+        double operator()(double qx, double qy) const {
+            double best = std::numeric_limits<double>::infinity();
+            for (int k = 0; k < 3; ++k) {
+                double rx = qx - ux[k], ry = qy - uy[k];
+                double t = clamp01((rx * dx[k] + ry * dy[k]) * inv[k]);
+                double ex = rx - t * dx[k], ey = ry - t * dy[k];
+                best = std::min(best, ex * ex + ey * ey);
+            }
+            return std::sqrt(best);
+        }
+#ifdef __SSE2__
+        __m128d operator()(__m128d qx, __m128d qy) const {
+            __m128d best = _mm_set1_pd(std::numeric_limits<double>::infinity());
+            for (int k = 0; k < 3; ++k) {
+                __m128d rx = _mm_sub_pd(qx, _mm_set1_pd(ux[k])), ry = _mm_sub_pd(qy, _mm_set1_pd(uy[k]));
+                __m128d sdx = _mm_set1_pd(dx[k]), sdy = _mm_set1_pd(dy[k]);
+                __m128d t = _mm_mul_pd(_mm_add_pd(_mm_mul_pd(rx, sdx), _mm_mul_pd(ry, sdy)), _mm_set1_pd(inv[k]));
+                t = _mm_min_pd(_mm_max_pd(t, _mm_setzero_pd()), _mm_set1_pd(1.0));
+                __m128d ex = _mm_sub_pd(rx, _mm_mul_pd(t, sdx)), ey = _mm_sub_pd(ry, _mm_mul_pd(t, sdy));
+                best = _mm_min_pd(best, _mm_add_pd(_mm_mul_pd(ex, ex), _mm_mul_pd(ey, ey)));
+            }
+            return _mm_sqrt_pd(best);
+        }
+#endif
+    };
+#ifdef __SSE2__
+    // SSE2 part of coverSpan: pixels two at a time; returns how many were done (an even count)
+    template <typename Dist>
+    int coverPairs(int py, int x0, int n, bool solid, const Dist& dist) {
+        float* cov = span.data();
+        const __m128d zero = _mm_setzero_pd(), half = _mm_set1_pd(0.5), one = _mm_set1_pd(1.0);
+        const __m128d absMask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+        auto hit = [&](__m128d d) {     // all-ones lanes where the sample is covered
+            return solid ? _mm_cmple_pd(d, zero) : _mm_cmple_pd(_mm_and_pd(d, absMask), half);
+        };
+        auto store = [&](int i, __m128d c) { _mm_storel_pi(reinterpret_cast<__m64*>(cov + i), _mm_cvtpd_ps(c)); };
+        int i = 0;
+        if (quality == RasterQuality::Analytic) {
+            const __m128d qy = _mm_set1_pd(py + 0.5);
+            for (; i + 1 < n; i += 2) {
+                __m128d d = dist(_mm_set_pd(x0 + i + 1.5, x0 + i + 0.5), qy);
+                __m128d c = solid ? _mm_sub_pd(half, d) : _mm_sub_pd(one, _mm_and_pd(d, absMask));
+                store(i, _mm_min_pd(_mm_max_pd(c, zero), one));
+            }
+        } else if (quality == RasterQuality::Supersample4x4) {
+            for (; i + 1 < n; i += 2) {
+                __m128d left = _mm_set_pd(x0 + i + 1, x0 + i), hits = zero;
+                for (int v = 0; v < 4; ++v) {
+                    __m128d qy = _mm_set1_pd(py + (v + 0.5) / 4);
+                    for (int u = 0; u < 4; ++u)
+                        hits = _mm_add_pd(hits, _mm_and_pd(hit(dist(_mm_add_pd(left, _mm_set1_pd((u + 0.5) / 4)), qy)), one));
+                }
+                store(i, _mm_mul_pd(hits, _mm_set1_pd(1.0 / 16)));
+            }
+        } else {
+            const __m128d qy = _mm_set1_pd(py + 0.5);
+            for (; i + 1 < n; i += 2) store(i, _mm_and_pd(hit(dist(_mm_set_pd(x0 + i + 1.5, x0 + i + 0.5), qy)), one));
+        }
+        return i;
+    }
+#endif
+    // Coverage of pixels [x0, x1] of row py; outlines are one pixel wide. With SSE2 (the
+    // x86-64 baseline) coverPairs does two pixels per step and the scalar loops below only
+    // finish an odd pixel; other targets run the scalar loops for the whole span.
+    template <typename Dist>
+    void coverSpan(int py, int x0, int x1, bool solid, const Dist& dist) {
+        float* cov = span.data();
+        int n = x1 - x0 + 1, start = 0;
+#ifdef __SSE2__
+        start = coverPairs(py, x0, n, solid, dist);
+#endif
+        double qy = py + 0.5;
+        if (quality == RasterQuality::Analytic) {
+            for (int i = start; i < n; ++i) {
+                double d = dist(x0 + i + 0.5, qy);
+                cov[i] = float(clamp01(solid ? 0.5 - d : 1.0 - std::fabs(d)));
+            }
+        } else if (quality == RasterQuality::Supersample4x4) {
+            for (int i = start; i < n; ++i) {
+                int hits = 0;
+                for (int v = 0; v < 4; ++v)
+                    for (int u = 0; u < 4; ++u) {
+                        double d = dist(x0 + i + (u + 0.5) / 4, py + (v + 0.5) / 4);
+                        hits += solid ? d <= 0 : std::fabs(d) <= 0.5;
+                    }
+                cov[i] = hits / 16.0f;
+            }
+        } else {
+            for (int i = start; i < n; ++i) {
+                double d = dist(x0 + i + 0.5, qy);
+                cov[i] = (solid ? d <= 0 : std::fabs(d) <= 0.5) ? 1.0f : 0.0f;
+            }
+        }
+        if (occlusion) {
+            for (int i = 0; i < n; ++i) write(x0 + i, py, (unsigned char)(cov[i] * 255.0f + 0.5f), solid);
+            return;
+        }
+        unsigned char* row = &pixels[size_t(py) * w];
+        for (int i = 0; i < n; ++i) {
+            unsigned char v = (unsigned char)(cov[i] * 255.0f + 0.5f);
+            row[x0 + i] = std::max(row[x0 + i], v);
+        }
+    }
+public:
+    Raster(int width, int height, const Bounds& viewport)
+        : w(std::max(width, 1)), h(std::max(height, 1)), view(viewport),
+          pixels(size_t(w) * h, 0), span(size_t(w)) {
+        double vw = view.maxX - view.minX, vh = view.maxY - view.minY;
+        sx = vw > 0 ? w / vw : 1.0;
+        sy = vh > 0 ? h / vh : 1.0;
+    }
+    int width() const { return w; }
+    int height() const { return h; }
+    const Bounds& viewport() const { return view; }
+    double pixelSize() const { return 1.0 / std::min(sx, sy); }     // world units per pixel
+    bool filling() const { return fillDepth > 0; }
+    RasterQuality getQuality() const { return quality; }
+    void setQuality(RasterQuality q) { quality = q; }
+    unsigned char at(int px, int py) const { return pixels[size_t(py) * w + px]; }
+    const std::vector<unsigned char>& data() const { return pixels; }
+    void clear() {
+        std::fill(pixels.begin(), pixels.end(), 0);
+        std::fill(opaque.begin(), opaque.end(), 0);
+        std::fill(blockOpaque.begin(), blockOpaque.end(), 0);
+        written = rejected = 0;
+    }
+
+    void enableOcclusion() {
+        if (occlusion) return;
+        occlusion = true;
+        opaque.assign(pixels.size(), 0);
+        blockOpaque.assign(size_t(blocksX()) * ((h + kBlock - 1) / kBlock), 0);
+    }
+    // True when every pixel under b (plus the 1px anti-aliasing margin) is already opaque.
+    // Fully opaque blocks are accepted without looking at their pixels.
+    bool occluded(const Bounds& b) const {
+        if (!occlusion || b.empty()) return false;
+        int x0 = int(std::floor(toPx(b.minX))) - 1, x1 = int(std::ceil(toPx(b.maxX))) + 1;
+        int y0 = int(std::floor(toPy(b.minY))) - 1, y1 = int(std::ceil(toPy(b.maxY))) + 1;
+        if (x0 < 0 || y0 < 0 || x1 >= w || y1 >= h) return false;      // partly off-screen never counts as hidden
+        for (int by = y0 / kBlock; by <= y1 / kBlock; ++by)
+            for (int bx = x0 / kBlock; bx <= x1 / kBlock; ++bx) {
+                if (blockOpaque[size_t(by) * blocksX() + bx] == blockCapacity(bx, by)) continue;
+                for (int py = std::max(y0, by * kBlock); py <= std::min(y1, by * kBlock + kBlock - 1); ++py)
+                    for (int px = std::max(x0, bx * kBlock); px <= std::min(x1, bx * kBlock + kBlock - 1); ++px)
+                        if (!opaque[size_t(py) * w + px]) return false;
+            }
+        return true;
+    }
+    // Adds this frame's pixel counters to stats
+    void collectStats(FrameStats& stats) const {
+        stats.pixelsWritten += written;
+        stats.pixelsRejected += rejected;
+        stats.pixelsCovered += size_t(std::count_if(pixels.begin(), pixels.end(), [](unsigned char p) { return p != 0; }));
+    }
+
+    void point(double x, double y, bool) override { plotPx(toPx(x), toPy(y)); }
+    void line(double x1, double y1, double x2, double y2, bool) override {
+        linePx(toPx(x1), toPy(y1), toPx(x2), toPy(y2));
+    }
+    void circle(double cx, double cy, double r, bool) override {
+        double pcx = toPx(cx), pcy = toPy(cy), rx = r * sx, ry = r * sy;
+        if (rx <= 0 || ry <= 0) { plotPx(pcx, pcy); return; }
+        double rmin = std::min(rx, ry);
+        int y0 = std::max(0, int(std::floor(pcy - ry - 1))), y1 = std::min(h - 1, int(std::ceil(pcy + ry + 1)));
+        int x0 = std::max(0, int(std::floor(pcx - rx - 1))), x1 = std::min(w - 1, int(std::ceil(pcx + rx + 1)));
+        if (x0 > x1) return;
+        CircleDist dist{pcx, pcy, rx, ry, rmin};
+        bool solid = filling();
+        for (int py = y0; py <= y1; ++py) coverSpan(py, x0, x1, solid, dist);
+    }
+    void triangle(const double* v, bool) override {
+        double ax = toPx(v[0]), ay = toPy(v[1]), bx = toPx(v[2]), by = toPy(v[3]), cx = toPx(v[4]), cy = toPy(v[5]);
+        int x0 = std::max(0, int(std::floor(std::min({ax, bx, cx}) - 1))), x1 = std::min(w - 1, int(std::ceil(std::max({ax, bx, cx}) + 1)));
+        int y0 = std::max(0, int(std::floor(std::min({ay, by, cy}) - 1))), y1 = std::min(h - 1, int(std::ceil(std::max({ay, by, cy}) + 1)));
+        if (x0 > x1) return;
+        double area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+        if (!filling() || area == 0) {
+            OutlineDist dist(ax, ay, bx, by, cx, cy);     // outline, or a degenerate fill
+            for (int py = y0; py <= y1; ++py) coverSpan(py, x0, x1, false, dist);
+            return;
+        }
+        double sgn = area > 0 ? 1.0 : -1.0;
+        double l0 = sgn / std::hypot(bx - ax, by - ay), l1 = sgn / std::hypot(cx - bx, cy - by), l2 = sgn / std::hypot(ax - cx, ay - cy);
+        TriangleDist dist{ax, ay, bx, by, cx, cy, l0, l1, l2};
+        for (int py = y0; py <= y1; ++py) coverSpan(py, x0, x1, true, dist);
+    }
+    // Closed and filled: even-odd scanline fill at pixel centers
+    void polyline(const double* xy, size_t n, bool closed, bool colored) override {
+        if (!closed || !filling() || n < 3) { ShapeSink::polyline(xy, n, closed, colored); return; }
+        std::vector<double> px(n), py(n), xs;
+        double ymin = std::numeric_limits<double>::infinity(), ymax = -ymin;
+        for (size_t i = 0; i < n; ++i) {
+            px[i] = toPx(xy[2 * i]); py[i] = toPy(xy[2 * i + 1]);
+            ymin = std::min(ymin, py[i]); ymax = std::max(ymax, py[i]);
+        }
+        int y0 = std::max(0, int(std::floor(ymin))), y1 = std::min(h - 1, int(std::ceil(ymax)));
+        for (int row = y0; row <= y1; ++row) {
+            double qy = row + 0.5;
+            xs.clear();
+            for (size_t i = 0, j = n - 1; i < n; j = i++)
+                if ((py[i] > qy) != (py[j] > qy))
+                    xs.push_back(px[j] + (qy - py[j]) * (px[i] - px[j]) / (py[i] - py[j]));
+            std::sort(xs.begin(), xs.end());
+            for (size_t k = 0; k + 1 < xs.size(); k += 2) {
+                int x0 = std::max(0, int(std::ceil(xs[k] - 0.5))), x1 = std::min(w - 1, int(std::floor(xs[k + 1] - 0.5)));
+                for (int col = x0; col <= x1; ++col) write(col, row, 255, true);
+            }
+        }
+    }
+    void beginFill() override { ++fillDepth; }
+    void endFill() override { --fillDepth; }
+};
+
+// LOD: a dot at the center instead of the full shape, for objects smaller than a pixel
+class LodSink : public ShapeSink {
+    Raster& r;
+public:
+    explicit LodSink(Raster& raster) : r(raster) {}
+    void point(double x, double y, bool c) override { r.point(x, y, c); }
+    void line(double x1, double y1, double x2, double y2, bool c) override { r.point((x1 + x2) / 2, (y1 + y2) / 2, c); }
+    void circle(double cx, double cy, double, bool c) override { r.point(cx, cy, c); }
+    void triangle(const double* v, bool c) override { r.point((v[0] + v[2] + v[4]) / 3, (v[1] + v[3] + v[5]) / 3, c); }
+    void polyline(const double* xy, size_t n, bool, bool c) override { if (n) r.point(xy[0], xy[1], c); }
+};
+
+// ====================== 1. Prototype ======================
+enum class ShapeKind { Point, Line, Circle, Triangle, Polyline, Composite, Other };
+constexpr int kShapeKinds = 7;
+
+class GraphObject {
+protected:
+    bool isColored;
+    int16_t layer = 0, zIndex = 0;      // draw order: by layer, then z, then insertion
+
+public:
+    GraphObject(bool colored = true) : isColored(colored) {}
+    virtual ~GraphObject() = default;
+
+    virtual GraphObject* clone() const = 0;
+    virtual void draw() const = 0;
+    virtual size_t memorySize() const = 0;
+    virtual Bounds bounds() const = 0;
+    virtual void emit(ShapeSink& sink) const = 0;
+    virtual void translate(double dx, double dy) = 0;
+    virtual size_t childCount() const { return 0; }
+    virtual const GraphObject* child(size_t) const { return nullptr; }
+    // Decorators expose the wrapped object here instead of as a child
+    virtual const GraphObject* decorated() const { return nullptr; }
+    virtual bool addsFill() const { return false; }
+    virtual ShapeKind kind() const { return ShapeKind::Other; }
+    // False when bounds() has to scan or build every element (bulk and lazy objects); the Scene
+    // statistics then leave the object out of the bounds instead of calling it on every add
+    virtual bool cheapBounds() const { return true; }
+    // Bulk containers add their elements per kind (and those they fill themselves) without
+    // visiting each one; single shapes and groups walked through child() return false
+    virtual bool countElements(size_t* /*byKind*/, size_t* /*filledByKind*/) const { return false; }
+    // Prefetches memory the object points to (adaptee, component, children); see forEachPrefetched
+    virtual void prefetchInner() const {}
+    virtual void simplify(double) {}    // only paths have something to drop
+
+    bool getColor() const { return isColored; }
+    int getLayer() const { return layer; }
+    int getZIndex() const { return zIndex; }
+    // Inside a Scene use Scene::setDepth so the cached draw order is updated
+    void setDepth(int newLayer, int z) {
+        layer = int16_t(std::max(-32768, std::min(32767, newLayer)));
+        zIndex = int16_t(std::max(-32768, std::min(32767, z)));
+    }
+    uint32_t sortKey() const { return (uint32_t(layer + 32768) << 16) | uint32_t(zIndex + 32768); }
+    // Layer or z read from text, clamped while still a double; NaN gives 0
+    static int depthValue(double v) { return v >= 32767 ? 32767 : v <= -32768 ? -32768 : v == v ? int(v) : 0; }
+};
+
+class Point : public GraphObject {
+    double x, y;
+public:
+    Point(double x = 0, double y = 0, bool colored = true)
+        : GraphObject(colored), x(x), y(y) {}
+    GraphObject* clone() const override { return new Point(*this); }
+    void draw() const override {
+        std::cout << (isColored ? "Color" : "B/W") << " Point (" << x << ", " << y << ")\n";
+    }
+    size_t memorySize() const override { return sizeof(Point); }
+    Bounds bounds() const override { return Bounds(x, y, x, y); }
+    void emit(ShapeSink& sink) const override { sink.point(x, y, isColored); }
+    void translate(double dx, double dy) override { x += dx; y += dy; }
+    ShapeKind kind() const override { return ShapeKind::Point; }
+};
+
+class Line : public GraphObject {
+    double x1, y1, x2, y2;
+public:
+    Line(double x1=0, double y1=0, double x2=0, double y2=0, bool colored=true)
+        : GraphObject(colored), x1(x1), y1(y1), x2(x2), y2(y2) {}
+    GraphObject* clone() const override { return new Line(*this); }
+    void draw() const override {
+        std::cout << (isColored ? "Color" : "B/W") << " Line (" << x1 << "," << y1
+                  << ")-(" << x2 << "," << y2 << ")\n";
+    }
+    size_t memorySize() const override { return sizeof(Line); }
+    Bounds bounds() const override { return Bounds(x1, y1, x2, y2); }
+    void emit(ShapeSink& sink) const override { sink.line(x1, y1, x2, y2, isColored); }
+    void translate(double dx, double dy) override { x1 += dx; y1 += dy; x2 += dx; y2 += dy; }
+    ShapeKind kind() const override { return ShapeKind::Line; }
+};
+
+class Circle : public GraphObject {
+    double cx, cy, r;
+public:
+    Circle(double cx=0, double cy=0, double r=1, bool colored=true)
+        : GraphObject(colored), cx(cx), cy(cy), r(r) {}
+    GraphObject* clone() const override { return new Circle(*this); }
+    void draw() const override {
+        std::cout << (isColored ? "Color" : "B/W") << " Circle (" << cx << "," << cy << ") r=" << r << "\n";
+    }
+    size_t memorySize() const override { return sizeof(Circle); }
+    Bounds bounds() const override { return Bounds(cx - r, cy - r, cx + r, cy + r); }
+    void emit(ShapeSink& sink) const override { sink.circle(cx, cy, r, isColored); }
+    void translate(double dx, double dy) override { cx += dx; cy += dy; }
+    ShapeKind kind() const override { return ShapeKind::Circle; }
+    double getRadius() const { return r; }
+    double getCenterX() const { return cx; }
+    double getCenterY() const { return cy; }
+    void setRadius(double radius) { r = radius; }
+};
+
+// ====================== Prefetching pointer-chasing loops ======================
+#if defined(__GNUC__) || defined(__clang__)
+#define GRAPH_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define GRAPH_PREFETCH(addr) ((void)(addr))
+#endif
+
+// How many objects ahead the traversal loops prefetch; 0 turns prefetching off
+inline size_t prefetchDistance = 8;
+
+// Calls f(at(i)) for i in [0, n). The object d = prefetchDistance steps ahead is prefetched,
+// and the pointers inside the object d/2 steps ahead, which has usually arrived by then.
+template <class At, class F>
+inline void forEachPrefetched(size_t n, At at, F f) {
+    size_t d = prefetchDistance, half = d / 2;
+    for (size_t i = 0; i < n; ++i) {
+        if (d && i + d < n) GRAPH_PREFETCH(at(i + d));
+        if (half && i + half < n) at(i + half)->prefetchInner();
+        f(at(i));
+    }
+}
+
+// ====================== Polyline and polygon ======================
+// Kernels over contiguous x,y vertex arrays. Bounds run on SSE2 with one (x, y) pair per
+// register (GCC keeps std::min/max on doubles scalar); the others are plain scalar loops.
+
+// Widens lo = (minX, minY) and hi = (maxX, maxY) by n interleaved x,y pairs. NaN coordinates
+// are skipped, as with std::min/std::max.
+inline void expandPairs(const double* xy, size_t n, double* lo, double* hi) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // Four accumulators hide the min/max latency. The new value goes first: minpd/maxpd
+    // return the second operand when either is NaN.
+    __m128d mn0 = _mm_loadu_pd(lo), mn1 = mn0, mn2 = mn0, mn3 = mn0;
+    __m128d mx0 = _mm_loadu_pd(hi), mx1 = mx0, mx2 = mx0, mx3 = mx0;
+    for (; i + 3 < n; i += 4) {
+        __m128d a = _mm_loadu_pd(xy + 2 * i), b = _mm_loadu_pd(xy + 2 * i + 2);
+        __m128d c = _mm_loadu_pd(xy + 2 * i + 4), d = _mm_loadu_pd(xy + 2 * i + 6);
+        mn0 = _mm_min_pd(a, mn0); mx0 = _mm_max_pd(a, mx0);
+        mn1 = _mm_min_pd(b, mn1); mx1 = _mm_max_pd(b, mx1);
+        mn2 = _mm_min_pd(c, mn2); mx2 = _mm_max_pd(c, mx2);
+        mn3 = _mm_min_pd(d, mn3); mx3 = _mm_max_pd(d, mx3);
+    }
+    _mm_storeu_pd(lo, _mm_min_pd(_mm_min_pd(mn0, mn1), _mm_min_pd(mn2, mn3)));
+    _mm_storeu_pd(hi, _mm_max_pd(_mm_max_pd(mx0, mx1), _mm_max_pd(mx2, mx3)));
+#endif
+    for (; i < n; ++i) {
+        lo[0] = std::min(lo[0], xy[2 * i]);     hi[0] = std::max(hi[0], xy[2 * i]);
+        lo[1] = std::min(lo[1], xy[2 * i + 1]); hi[1] = std::max(hi[1], xy[2 * i + 1]);
+    }
+}
+
+inline Bounds pathBounds(const double* xy, size_t n) {
+    if (!n) return Bounds();
+    double lo[2] = {xy[0], xy[1]}, hi[2] = {xy[0], xy[1]};
+    expandPairs(xy + 2, n - 1, lo, hi);
+    return Bounds(lo[0], lo[1], hi[0], hi[1]);
+}
+
+inline double pathLength(const double* xy, size_t n, bool closed) {
+    double len = 0;
+    for (size_t i = 1; i < n; ++i) len += std::hypot(xy[2 * i] - xy[2 * i - 2], xy[2 * i + 1] - xy[2 * i - 1]);
+    if (closed && n > 2) len += std::hypot(xy[0] - xy[2 * n - 2], xy[1] - xy[2 * n - 1]);
+    return len;
+}
+
+// Shoelace formula, positive for counter-clockwise vertices
+inline double polygonArea(const double* xy, size_t n) {
+    if (n < 3) return 0;
+    double twice = xy[2 * n - 2] * xy[1] - xy[0] * xy[2 * n - 1];
+    for (size_t i = 1; i < n; ++i) twice += xy[2 * i - 2] * xy[2 * i + 1] - xy[2 * i] * xy[2 * i - 1];
+    return twice / 2;
+}
+
+// Even-odd crossing test, branch-free per edge
+inline bool pointInPolygon(const double* xy, size_t n, double x, double y) {
+    unsigned crossings = 0;
+    for (size_t i = 0, j = n - 1; i < n; j = i++) {
+        double xi = xy[2 * i], yi = xy[2 * i + 1], xj = xy[2 * j], yj = xy[2 * j + 1];
+        bool spans = (yi > y) != (yj > y);
+        double t = spans ? (y - yi) / (yj - yi) : 0.0;
+        crossings += unsigned(spans && x < xi + t * (xj - xi));
+    }
+    return crossings & 1u;
+}
+
+class Polyline : public GraphObject {
+protected:
+    std::vector<double> xy;     // x0,y0,x1,y1,...
+    bool closed;
+    Polyline(std::vector<double> coords, bool isClosed, bool colored)
+        : GraphObject(colored), xy(std::move(coords)), closed(isClosed) { xy.resize(xy.size() & ~size_t(1)); }
+    void drawVertices(const char* name) const {
+        std::cout << (isColored ? "Color" : "B/W") << " " << name << " (" << vertexCount() << " vertices):";
+        for (size_t i = 0; i < vertexCount(); ++i) std::cout << " (" << xy[2 * i] << "," << xy[2 * i + 1] << ")";
+        std::cout << "\n";
+    }
+public:
+    Polyline(std::vector<double> coords = {}, bool colored = true) : Polyline(std::move(coords), false, colored) {}
+    GraphObject* clone() const override { return new Polyline(*this); }
+    void draw() const override { drawVertices("Polyline"); }
+    size_t memorySize() const override { return sizeof(*this) + xy.capacity() * sizeof(double); }
+    Bounds bounds() const override { return pathBounds(xy.data(), vertexCount()); }
+    void emit(ShapeSink& sink) const override { sink.polyline(xy.data(), vertexCount(), closed, isColored); }
+    void translate(double dx, double dy) override {
+        for (size_t i = 0; i < xy.size(); i += 2) { xy[i] += dx; xy[i + 1] += dy; }
+    }
+    void simplify(double eps) override;
+    ShapeKind kind() const override { return ShapeKind::Polyline; }
+    size_t vertexCount() const { return xy.size() / 2; }
+    const double* vertices() const { return xy.data(); }
+    double length() const { return pathLength(xy.data(), vertexCount(), closed); }
+};
+
+class Polygon : public Polyline {
+public:
+    Polygon(std::vector<double> coords = {}, bool colored = true) : Polyline(std::move(coords), true, colored) {}
+    GraphObject* clone() const override { return new Polygon(*this); }
+    void draw() const override { drawVertices("Polygon"); }
+    double area() const { return std::fabs(polygonArea(xy.data(), vertexCount())); }
+    bool contains(double x, double y) const { return pointInPolygon(xy.data(), vertexCount(), x, y); }
+};
+
+// ====================== Indexed triangle mesh ======================
+// Shared vertices stored once; each triangle is three indices into the vertex buffer
+class TriangleMesh : public GraphObject {
+    static constexpr size_t kChunk = 256;
+    std::vector<double> vertices;       // x,y pairs
+    std::vector<uint32_t> indices;      // 3 per triangle
+
+    void gather(size_t first, size_t n, double* v) const {
+        for (size_t t = 0; t < n; ++t)
+            for (size_t k = 0; k < 3; ++k) {
+                uint32_t idx = indices[3 * (first + t) + k];
+                v[6 * t + 2 * k] = vertices[2 * idx];
+                v[6 * t + 2 * k + 1] = vertices[2 * idx + 1];
+            }
+    }
+public:
+    TriangleMesh(std::vector<double> verts = {}, std::vector<uint32_t> idx = {}, bool colored = true)
+        : GraphObject(colored), vertices(std::move(verts)), indices(std::move(idx)) {
+        indices.resize(indices.size() - indices.size() % 3);
+    }
+
+    // Builds a mesh from count triangles (x1,y1,x2,y2,x3,y3 each), welding vertices closer than eps.
+    // Candidates come from a hash grid with cells of at least eps, so a lookup checks the 3x3 cells around.
+    static TriangleMesh* weld(const double* tris, size_t count, double eps = 1e-9, bool colored = true) {
+        eps = eps > 0 ? eps : 1e-9;
+        std::vector<double> verts;
+        std::vector<uint32_t> idx;
+        std::vector<uint32_t> chain;                    // next vertex in the same cell
+        std::unordered_map<uint64_t, uint32_t> head;    // cell -> first vertex
+        const uint32_t none = uint32_t(-1);
+        auto cellKey = [](int64_t cx, int64_t cy) { return uint64_t(cx) * 0x9E3779B97F4A7C15ull ^ uint64_t(cy); };
+        // Cells grow with the input range so cell coordinates stay well inside int64;
+        // non-finite coordinates all share cell 0 (they never weld anyway)
+        double range = 0;
+        for (size_t i = 0; i < 6 * count; ++i)
+            if (std::isfinite(tris[i])) range = std::max(range, std::fabs(tris[i]));
+        double cell = std::max(eps, range * 0x1p-52);
+        auto toCell = [cell](double v) {
+            double c = std::floor(v / cell);
+            return std::isfinite(c) ? int64_t(c) : int64_t(0);
+        };
+        verts.reserve(count * 2);
+        idx.reserve(count * 3);
+        head.reserve(count * 2);
+
+        for (size_t i = 0; i < 3 * count; ++i) {
+            double x = tris[2 * i], y = tris[2 * i + 1];
+            int64_t cx = toCell(x), cy = toCell(y);
+            uint32_t found = none;
+            for (int64_t ny = cy - 1; ny <= cy + 1 && found == none; ++ny)
+                for (int64_t nx = cx - 1; nx <= cx + 1 && found == none; ++nx) {
+                    auto it = head.find(cellKey(nx, ny));
+                    for (uint32_t v = it != head.end() ? it->second : none; v != none; v = chain[v])
+                        if (std::fabs(verts[2 * v] - x) <= eps && std::fabs(verts[2 * v + 1] - y) <= eps) { found = v; break; }
+                }
+            if (found == none) {
+                found = uint32_t(chain.size());
+                verts.push_back(x); verts.push_back(y);
+                auto ins = head.emplace(cellKey(cx, cy), found);
+                chain.push_back(ins.second ? none : ins.first->second);
+                ins.first->second = found;
+            }
+            idx.push_back(found);
+        }
+        verts.shrink_to_fit();
+        return new TriangleMesh(std::move(verts), std::move(idx), colored);
+    }
+
+    size_t vertexCount() const { return vertices.size() / 2; }
+    size_t triangleCount() const { return indices.size() / 3; }
+
+    GraphObject* clone() const override { return new TriangleMesh(*this); }
+    void draw() const override {
+        std::cout << (isColored ? "Color" : "B/W") << " Triangle mesh (" << vertexCount() << " vertices, "
+                  << triangleCount() << " triangles):\n";
+        for (size_t t = 0; t < triangleCount(); ++t) {
+            double v[6]; gather(t, 1, v);
+            std::cout << "   Triangle (" << v[0] << "," << v[1] << ") (" << v[2] << "," << v[3]
+                      << ") (" << v[4] << "," << v[5] << ")\n";
+        }
+    }
+    size_t memorySize() const override {
+        return sizeof(TriangleMesh) + vertices.capacity() * sizeof(double) + indices.capacity() * sizeof(uint32_t);
+    }
+    Bounds bounds() const override { return pathBounds(vertices.data(), vertexCount()); }
+    bool cheapBounds() const override { return false; }
+    bool countElements(size_t* byKind, size_t*) const override {
+        byKind[int(ShapeKind::Triangle)] += triangleCount();
+        return true;
+    }
+    void emit(ShapeSink& sink) const override {
+        double v[6 * kChunk];
+        for (size_t first = 0; first < triangleCount(); first += kChunk) {
+            size_t n = std::min(kChunk, triangleCount() - first);
+            gather(first, n, v);
+            sink.triangles(v, n, isColored);
+        }
+    }
+    void translate(double dx, double dy) override {
+        for (size_t i = 0; i < vertices.size(); i += 2) { vertices[i] += dx; vertices[i + 1] += dy; }
+    }
+};
+
+// ====================== Zero-copy views over external buffers ======================
+enum class BufferShape { Points, Circles, Triangles };     // x,y | cx,cy,r | x1,y1,x2,y2,x3,y3
+
+// Adapts an externally owned strided buffer; the handle keeps the owner alive
+template <typename T>
+class BufferView : public GraphObject {
+    static constexpr size_t kChunk = 256;
+    std::shared_ptr<const T> handle;
+    size_t count, stride;       // stride in elements between records
+    BufferShape shape;
+    double ox = 0, oy = 0;      // translation applied on read, the buffer stays untouched
+
+    // k-th component of record i, radius is not translated
+    double coord(size_t i, size_t k) const {
+        double v = handle.get()[i * stride + k];
+        if (shape == BufferShape::Circles && k == 2) return v;
+        return v + (k % 2 ? oy : ox);
+    }
+public:
+    static size_t components(BufferShape s) {
+        return s == BufferShape::Points ? 2 : s == BufferShape::Circles ? 3 : 6;
+    }
+    BufferView(std::shared_ptr<const T> data, size_t n, BufferShape s, size_t strideElems = 0, bool colored = true)
+        : GraphObject(colored), handle(std::move(data)), count(handle ? n : 0),
+          stride(strideElems ? strideElems : components(s)), shape(s) {}
+    GraphObject* clone() const override { return new BufferView(*this); }
+    void draw() const override {
+        static const char* names[] = { "Point", "Circle", "Triangle" };
+        std::cout << (isColored ? "Color" : "B/W") << " " << names[int(shape)] << " view ("
+                  << count << " records):\n";
+        for (size_t i = 0; i < count; ++i) {
+            if (shape == BufferShape::Points)
+                std::cout << "   Point (" << coord(i, 0) << ", " << coord(i, 1) << ")\n";
+            else if (shape == BufferShape::Circles)
+                std::cout << "   Circle (" << coord(i, 0) << "," << coord(i, 1) << ") r=" << coord(i, 2) << "\n";
+            else
+                std::cout << "   Triangle (" << coord(i, 0) << "," << coord(i, 1) << ") (" << coord(i, 2) << ","
+                          << coord(i, 3) << ") (" << coord(i, 4) << "," << coord(i, 5) << ")\n";
+        }
+    }
+    size_t memorySize() const override { return sizeof(BufferView); }
+    size_t size() const { return count; }
+    Bounds bounds() const override {
+        Bounds b;
+        for (size_t i = 0; i < count; ++i) {
+            if (shape == BufferShape::Circles) {
+                double r = coord(i, 2);
+                b.expand(coord(i, 0) - r, coord(i, 1) - r); b.expand(coord(i, 0) + r, coord(i, 1) + r);
+            } else {
+                size_t n = components(shape);
+                for (size_t k = 0; k < n; k += 2) b.expand(coord(i, k), coord(i, k + 1));
+            }
+        }
+        return b;
+    }
+    bool cheapBounds() const override { return false; }
+    bool countElements(size_t* byKind, size_t*) const override {
+        static const ShapeKind kinds[] = { ShapeKind::Point, ShapeKind::Circle, ShapeKind::Triangle };
+        byKind[int(kinds[int(shape)])] += count;
+        return true;
+    }
+    void emit(ShapeSink& sink) const override {
+        if (shape == BufferShape::Points) {
+            for (size_t i = 0; i < count; ++i) sink.point(coord(i, 0), coord(i, 1), isColored);
+        } else if (shape == BufferShape::Circles) {
+            for (size_t i = 0; i < count; ++i) sink.circle(coord(i, 0), coord(i, 1), coord(i, 2), isColored);
+        } else {
+            double v[6 * kChunk];
+            for (size_t first = 0; first < count; first += kChunk) {
+                size_t n = std::min(kChunk, count - first);
+                for (size_t i = 0; i < n; ++i)
+                    for (size_t k = 0; k < 6; ++k) v[6 * i + k] = coord(first + i, k);
+                sink.triangles(v, n, isColored);
+            }
+        }
+    }
+    void translate(double dx, double dy) override { ox += dx; oy += dy; }
+};
+
+// ====================== Parallel loops ======================
+// Calls fn(w) for every w in [0, workers): worker 0 runs on the calling thread, the others on
+// threads started here. Returns once all of them have finished.
+template <typename F>
+void parallelFor(size_t workers, F&& fn) {
+    std::vector<std::thread> pool;
+    for (size_t w = 1; w < workers; ++w) pool.emplace_back([&fn, w] { fn(w); });
+    if (workers) fn(0);
+    for (auto& th : pool) th.join();
+}
+
+// ====================== Draw order: stable parallel radix sort ======================
+// LSD radix sort of values by keys, 8 bits per pass. Every thread histograms its own chunk,
+// so chunks scatter in parallel and equal keys keep their order. Passes where all keys share
+// the digit are skipped.
+inline void radixSortByKey(std::vector<uint32_t>& keys, std::vector<uint32_t>& values,
+                           unsigned threads = std::thread::hardware_concurrency()) {
+    size_t n = keys.size();
+    if (n < 2) return;
+    threads = unsigned(std::max<size_t>(1, std::min<size_t>(threads, n / 65536)));
+    std::vector<uint32_t> keysOut(n), valuesOut(n);
+    std::vector<size_t> offset(size_t(threads) * 256);
+    auto chunk = [&](size_t t, size_t& first, size_t& last) { first = n * t / threads; last = n * (t + 1) / threads; };
+    for (int shift = 0; shift < 32; shift += 8) {
+        std::fill(offset.begin(), offset.end(), 0);
+        parallelFor(threads, [&](size_t t) {
+            size_t first, last; chunk(t, first, last);
+            size_t* h = &offset[size_t(t) * 256];
+            for (size_t i = first; i < last; ++i) ++h[(keys[i] >> shift) & 255];
+        });
+        size_t sum = 0;
+        bool trivial = false;
+        for (int d = 0; d < 256; ++d) {
+            size_t digitTotal = 0;
+            for (unsigned t = 0; t < threads; ++t) {
+                size_t c = offset[size_t(t) * 256 + d];
+                offset[size_t(t) * 256 + d] = sum;
+                sum += c; digitTotal += c;
+            }
+            if (digitTotal == n) trivial = true;
+        }
+        if (trivial) continue;
+        parallelFor(threads, [&](size_t t) {
+            size_t first, last; chunk(t, first, last);
+            size_t* pos = &offset[size_t(t) * 256];
+            for (size_t i = first; i < last; ++i) {
+                size_t at = pos[(keys[i] >> shift) & 255]++;
+                keysOut[at] = keys[i];
+                valuesOut[at] = values[i];
+            }
+        });
+        keys.swap(keysOut);
+        values.swap(valuesOut);
+    }
+}
+
+// ====================== Scene traversal: flattened depth-first view ======================
+// Leaf object reached through composites and decorators; filled is set when any decorator
+// on the way adds fill, depth counts the containers passed.
+struct FlatItem {
+    const GraphObject* object;
+    unsigned depth;
+    bool filled;
+};
+
+// Forward iterator over the leaves under a list of roots (optionally permuted by order).
+// Nothing is copied up front: the iterator keeps only the path to the current leaf.
+class FlatIterator {
+    struct Frame { const GraphObject* node; size_t next; bool filled; };
+    GraphObject* const* roots = nullptr;
+    const uint32_t* order = nullptr;
+    size_t rootCount = 0, nextRoot = 0;
+    std::vector<Frame> path;
+    FlatItem current{nullptr, 0, false};
+
+    static size_t fanout(const GraphObject* g) { return g->decorated() ? 1 : g->childCount(); }
+    static const GraphObject* inner(const GraphObject* g, size_t i) {
+        const GraphObject* d = g->decorated();
+        return d ? d : g->child(i);
+    }
+    void descend(const GraphObject* g, bool filled) {
+        while (fanout(g) > 0) {
+            filled = filled || g->addsFill();
+            path.push_back({g, 1, filled});
+            g = inner(g, 0);
+        }
+        current = {g, unsigned(path.size()), filled};
+    }
+    void advance() {
+        while (!path.empty()) {
+            Frame& f = path.back();
+            if (f.next < fanout(f.node)) {
+                const GraphObject* g = inner(f.node, f.next++);
+                descend(g, f.filled);
+                return;
+            }
+            path.pop_back();
+        }
+        if (nextRoot < rootCount) {
+            size_t i = nextRoot++;
+            descend(roots[order ? order[i] : i], false);
+            return;
+        }
+        *this = FlatIterator();     // exhausted: equal to end()
+    }
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = FlatItem;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const FlatItem*;
+    using reference = const FlatItem&;
+
+    FlatIterator() = default;
+    FlatIterator(GraphObject* const* roots, const uint32_t* order, size_t count)
+        : roots(roots), order(order), rootCount(count) { advance(); }
+    reference operator*() const { return current; }
+    pointer operator->() const { return &current; }
+    FlatIterator& operator++() { advance(); return *this; }
+    FlatIterator operator++(int) { FlatIterator old = *this; advance(); return old; }
+    bool operator==(const FlatIterator& o) const { return current.object == o.current.object && nextRoot == o.nextRoot; }
+    bool operator!=(const FlatIterator& o) const { return !(*this == o); }
+};
+
+class FlatRange {
+    GraphObject* const* roots;
+    const uint32_t* order;
+    size_t count;
+public:
+    FlatRange(GraphObject* const* roots, const uint32_t* order, size_t count)
+        : roots(roots), order(order), count(count) {}
+    FlatIterator begin() const { return FlatIterator(roots, order, count); }
+    FlatIterator end() const { return FlatIterator(); }
+    template <class Pred> auto where(Pred pred) const;
+};
+
+// Lazy filter over a range of FlatItem: items are tested one by one while iterating, so a
+// consumer that stops early never touches (or, for lazy blocks, builds) the rest.
+template <class Range, class Pred>
+class FilteredRange {
+    Range base;
+    Pred pred;
+    using BaseIterator = decltype(std::declval<const Range&>().begin());
+public:
+    class iterator {
+        BaseIterator it, last;
+        const Pred* pred = nullptr;
+        void skip() { while (it != last && !(*pred)(*it)) ++it; }
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = FlatItem;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const FlatItem*;
+        using reference = const FlatItem&;
+
+        iterator() = default;
+        iterator(BaseIterator first, BaseIterator last, const Pred* pred) : it(first), last(last), pred(pred) { skip(); }
+        reference operator*() const { return *it; }
+        pointer operator->() const { return &*it; }
+        iterator& operator++() { ++it; skip(); return *this; }
+        iterator operator++(int) { iterator old = *this; ++*this; return old; }
+        bool operator==(const iterator& o) const { return it == o.it; }
+        bool operator!=(const iterator& o) const { return it != o.it; }
+    };
+    FilteredRange(Range base, Pred pred) : base(std::move(base)), pred(std::move(pred)) {}
+    iterator begin() const { return iterator(base.begin(), base.end(), &pred); }
+    iterator end() const { return iterator(base.end(), base.end(), &pred); }
+    template <class Next> FilteredRange<FilteredRange, Next> where(Next next) const { return {*this, std::move(next)}; }
+};
+template <class Pred> auto FlatRange::where(Pred pred) const { return FilteredRange<FlatRange, Pred>(*this, std::move(pred)); }
+
+// Ready-made filters for where()
+template <class T>
+inline auto ofType() { return [](const FlatItem& it) { return dynamic_cast<const T*>(it.object) != nullptr; }; }
+inline auto filledOnly() { return [](const FlatItem& it) { return it.filled; }; }
+inline auto inRegion(const Bounds& region) {
+    return [region](const FlatItem& it) { return it.object->bounds().intersects(region); };
+}
+
+// ====================== 2. Singleton ======================
+// Scene totals kept up to date by every Scene mutation. Shapes are the leaves reached through
+// composites and decorators; bulk and lazy objects count their elements without visiting them.
+// Their bounds would need a full scan, so they are left out (see unbounded); Scene::bounds()
+// gives the full extent.
+struct SceneStats {
+    static constexpr int kSizeBins = 16;
+    size_t objects = 0;                     // top level
+    size_t byKind[kShapeKinds] = {};        // composites included, at every depth
+    size_t shapes = 0, filledShapes = 0, filledTriangles = 0;
+    size_t memory = 0;                      // deep, through composites and decorators
+    Bounds bounds;                          // of the objects with cheap bounds
+    size_t unbounded = 0;                   // top-level bulk and lazy objects left out of bounds and histogram
+    size_t sizeHistogram[kSizeBins] = {};   // top-level objects: bin 0 < 1 unit, bin k < 2^k units
+    size_t count(ShapeKind k) const { return byKind[int(k)]; }
+    double fillRatio() const { return shapes ? double(filledShapes) / double(shapes) : 0.0; }
+};
+
+class Scene {
+private:
+    static Scene* instance;
+    std::vector<GraphObject*> objects;
+
+    // Cached draw order: indices into objects sorted by (layer, z), stable. It covers
+    // objects [0, ordered); later additions are merged in on the next read.
+    mutable std::vector<uint32_t> order;
+    mutable size_t ordered = 0;
+    mutable bool orderStale = false;            // full re-sort needed
+    mutable std::atomic<bool> orderReady{true};
+    mutable std::mutex orderMutex;
+
+    // Running statistics; the mutex only serializes writers with stats() readers
+    mutable std::mutex statsMutex;
+    SceneStats totals;
+    size_t edgeHits[4] = {};    // objects lying on minX, minY, maxX, maxY of totals.bounds
+    bool boundsStale = false;
+
+    Scene() = default;
+    static void tally(const GraphObject* g, bool filled, SceneStats& s) {
+        s.memory += g->memorySize();
+        if (const GraphObject* inner = g->decorated()) { tally(inner, filled || g->addsFill(), s); return; }
+        size_t elements[kShapeKinds] = {}, filledElements[kShapeKinds] = {};
+        if (g->countElements(elements, filledElements)) {
+            for (int k = 0; k < kShapeKinds; ++k) {
+                s.byKind[k] += elements[k];
+                if (k == int(ShapeKind::Composite)) continue;
+                size_t f = filled ? elements[k] : filledElements[k];
+                s.shapes += elements[k];
+                s.filledShapes += f;
+                if (k == int(ShapeKind::Triangle)) s.filledTriangles += f;
+            }
+            return;
+        }
+        ShapeKind k = g->kind();
+        ++s.byKind[int(k)];
+        if (k == ShapeKind::Composite) {
+            for (size_t i = 0; i < g->childCount(); ++i) tally(g->child(i), filled, s);
+            return;
+        }
+        ++s.shapes;
+        if (filled) { ++s.filledShapes; if (k == ShapeKind::Triangle) ++s.filledTriangles; }
+    }
+    static int sizeBin(const Bounds& b) {
+        double side = b.empty() ? 0.0 : std::max(b.maxX - b.minX, b.maxY - b.minY);
+        int bin = 0;
+        while (bin + 1 < SceneStats::kSizeBins && side >= double(1u << bin)) ++bin;
+        return bin;
+    }
+    void expandEdges(const Bounds& b, const size_t* hits) {
+        if (b.empty()) return;
+        auto edge = [](double v, double& cur, size_t& count, size_t n, bool lower) {
+            if (lower ? v < cur : v > cur) { cur = v; count = n; }
+            else if (v == cur) count += n;
+        };
+        edge(b.minX, totals.bounds.minX, edgeHits[0], hits[0], true);
+        edge(b.minY, totals.bounds.minY, edgeHits[1], hits[1], true);
+        edge(b.maxX, totals.bounds.maxX, edgeHits[2], hits[2], false);
+        edge(b.maxY, totals.bounds.maxY, edgeHits[3], hits[3], false);
+    }
+    // Adds (sign > 0) or takes away the statistics of one top-level object. Taking away an object
+    // that lies on the scene bounds marks them stale; settleStats() then rescans.
+    void account(const GraphObject* obj, int sign) {
+        SceneStats d;
+        tally(obj, false, d);
+        bool known = obj->cheapBounds();
+        Bounds b = known ? obj->bounds() : Bounds();
+        auto add = [sign](size_t& v, size_t x) { v = sign > 0 ? v + x : v - x; };
+        std::lock_guard<std::mutex> lock(statsMutex);
+        add(totals.objects, 1);
+        for (int k = 0; k < kShapeKinds; ++k) add(totals.byKind[k], d.byKind[k]);
+        add(totals.shapes, d.shapes);
+        add(totals.filledShapes, d.filledShapes);
+        add(totals.filledTriangles, d.filledTriangles);
+        add(totals.memory, d.memory);
+        if (known) add(totals.sizeHistogram[sizeBin(b)], 1);
+        else add(totals.unbounded, 1);
+        if (sign > 0) {
+            const size_t one[4] = {1, 1, 1, 1};
+            expandEdges(b, one);
+        } else if (!b.empty()) {
+            const double* cur[4] = {&totals.bounds.minX, &totals.bounds.minY, &totals.bounds.maxX, &totals.bounds.maxY};
+            const double v[4] = {b.minX, b.minY, b.maxX, b.maxY};
+            for (int e = 0; e < 4; ++e)
+                if (v[e] == *cur[e] && --edgeHits[e] == 0) boundsStale = true;
+        }
+    }
+    void settleStats() {
+        if (!boundsStale) return;
+        const size_t one[4] = {1, 1, 1, 1};
+        std::lock_guard<std::mutex> lock(statsMutex);
+        totals.bounds = Bounds();
+        std::fill(std::begin(edgeHits), std::end(edgeHits), size_t(0));
+        for (const auto* obj : objects)
+            if (obj->cheapBounds()) expandEdges(obj->bounds(), one);
+        boundsStale = false;
+    }
+    void resetStats() {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        totals = SceneStats();
+        std::fill(std::begin(edgeHits), std::end(edgeHits), size_t(0));
+        boundsStale = false;
+    }
+    // Takes over the statistics of a scene whose objects were moved here
+    void absorbStats(Scene& other) {
+        other.settleStats();
+        SceneStats o;
+        size_t hits[4];
+        {
+            std::lock_guard<std::mutex> lock(other.statsMutex);
+            o = other.totals;
+            std::copy(std::begin(other.edgeHits), std::end(other.edgeHits), hits);
+        }
+        other.resetStats();
+        std::lock_guard<std::mutex> lock(statsMutex);
+        totals.objects += o.objects;
+        for (int k = 0; k < kShapeKinds; ++k) totals.byKind[k] += o.byKind[k];
+        totals.shapes += o.shapes;
+        totals.filledShapes += o.filledShapes;
+        totals.filledTriangles += o.filledTriangles;
+        totals.memory += o.memory;
+        totals.unbounded += o.unbounded;
+        for (int i = 0; i < SceneStats::kSizeBins; ++i) totals.sizeHistogram[i] += o.sizeHistogram[i];
+        expandEdges(o.bounds, hits);
+    }
+    void invalidateOrder() { orderStale = true; orderReady.store(false, std::memory_order_release); }
+    bool drawsBefore(uint32_t a, uint32_t b) const {
+        uint32_t ka = objects[a]->sortKey(), kb = objects[b]->sortKey();
+        return ka < kb || (ka == kb && a < b);
+    }
+    void updateOrder() const {
+        size_t fresh = objects.size() - ordered;
+        if (orderStale || fresh > 64 + order.size() / 16) {
+            std::vector<uint32_t> keys(objects.size());
+            order.resize(objects.size());
+            for (size_t i = 0; i < objects.size(); ++i) { keys[i] = objects[i]->sortKey(); order[i] = uint32_t(i); }
+            radixSortByKey(keys, order);
+        } else {
+            for (size_t i = ordered; i < objects.size(); ++i) {
+                uint32_t idx = uint32_t(i);
+                order.insert(std::upper_bound(order.begin(), order.end(), idx,
+                                              [&](uint32_t a, uint32_t b) { return drawsBefore(a, b); }), idx);
+            }
+        }
+        ordered = objects.size();
+        orderStale = false;
+    }
+public:
+    static Scene* getInstance() {
+        if (!instance) instance = new Scene();
+        return instance;
+    }
+    // Separately built scene (per thread, per file) to be merged into another one later
+    static std::unique_ptr<Scene> createShard() { return std::unique_ptr<Scene>(new Scene()); }
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+    void addObject(GraphObject* obj) {
+        if (!obj) return;
+        objects.push_back(obj);
+        orderReady.store(false, std::memory_order_release);
+        account(obj, 1);
+    }
+    // Deletes obj (owned by this scene); O(n) in the scene size
+    bool removeObject(GraphObject* obj) {
+        auto it = std::find(objects.begin(), objects.end(), obj);
+        if (it == objects.end()) return false;
+        account(obj, -1);
+        objects.erase(it);
+        invalidateOrder();
+        settleStats();
+        delete obj;
+        return true;
+    }
+    // Changes obj (owned by this scene) through fn, keeping statistics and draw order current.
+    // Objects changed behind the scene's back (Animator, direct translate) need recountStats().
+    template <typename Fn>
+    void modify(GraphObject* obj, Fn&& fn) {
+        if (!obj) return;
+        account(obj, -1);
+        int layer = obj->getLayer(), z = obj->getZIndex();
+        fn(*obj);
+        account(obj, 1);
+        settleStats();
+        int newLayer = obj->getLayer(), newZ = obj->getZIndex();
+        if (newLayer != layer || newZ != z) {
+            obj->setDepth(layer, z);
+            setDepth(obj, newLayer, newZ);
+        }
+    }
+    // O(1) snapshot, callable from any thread
+    SceneStats stats() const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return totals;
+    }
+    // Full recount, for changes the scene did not see
+    void recountStats() {
+        resetStats();
+        for (const auto* obj : objects) account(obj, 1);
+    }
+    GraphObject* lastAdded() const { return objects.empty() ? nullptr : objects.back(); }
+    // Index permutation in draw order; safe to call from several threads
+    const std::vector<uint32_t>& drawOrder() const {
+        if (orderReady.load(std::memory_order_acquire)) return order;
+        std::lock_guard<std::mutex> lock(orderMutex);
+        if (!orderReady.load(std::memory_order_relaxed)) {
+            updateOrder();
+            orderReady.store(true, std::memory_order_release);
+        }
+        return order;
+    }
+    // Changes the depth of obj (owned by this scene); the cached order is patched in place
+    void setDepth(GraphObject* obj, int layer, int z) {
+        if (!obj) return;
+        drawOrder();
+        auto it = std::find_if(order.begin(), order.end(), [&](uint32_t i) { return objects[i] == obj; });
+        obj->setDepth(layer, z);
+        if (it == order.end()) return;
+        uint32_t idx = *it;
+        order.erase(it);
+        order.insert(std::lower_bound(order.begin(), order.end(), idx,
+                                      [&](uint32_t a, uint32_t b) { return drawsBefore(a, b); }), idx);
+    }
+    void reserve(size_t n) { objects.reserve(objects.size() + n); }
+    size_t size() const { return objects.size(); }
+    // i-th object in draw order
+    const GraphObject* at(size_t i) const { return objects[drawOrder()[i]]; }
+
+    // Random-access iterator over the top-level objects in draw order, without copying
+    // pointers out; fits std::for_each / std::transform_reduce with execution policies.
+    class const_iterator {
+        GraphObject* const* objs = nullptr;
+        const uint32_t* pos = nullptr;
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = GraphObject*;
+        using difference_type = std::ptrdiff_t;
+        using pointer = GraphObject* const*;
+        using reference = GraphObject* const&;
+
+        const_iterator() = default;
+        const_iterator(GraphObject* const* objs, const uint32_t* pos) : objs(objs), pos(pos) {}
+        reference operator*() const { return objs[*pos]; }
+        pointer operator->() const { return &objs[*pos]; }
+        reference operator[](difference_type n) const { return objs[pos[n]]; }
+        const_iterator& operator++() { ++pos; return *this; }
+        const_iterator operator++(int) { const_iterator old = *this; ++pos; return old; }
+        const_iterator& operator--() { --pos; return *this; }
+        const_iterator operator--(int) { const_iterator old = *this; --pos; return old; }
+        const_iterator& operator+=(difference_type n) { pos += n; return *this; }
+        const_iterator& operator-=(difference_type n) { pos -= n; return *this; }
+        friend const_iterator operator+(const_iterator it, difference_type n) { return it += n; }
+        friend const_iterator operator+(difference_type n, const_iterator it) { return it += n; }
+        friend const_iterator operator-(const_iterator it, difference_type n) { return it -= n; }
+        friend difference_type operator-(const const_iterator& a, const const_iterator& b) { return a.pos - b.pos; }
+        bool operator==(const const_iterator& o) const { return pos == o.pos; }
+        bool operator!=(const const_iterator& o) const { return pos != o.pos; }
+        bool operator<(const const_iterator& o) const { return pos < o.pos; }
+        bool operator>(const const_iterator& o) const { return pos > o.pos; }
+        bool operator<=(const const_iterator& o) const { return pos <= o.pos; }
+        bool operator>=(const const_iterator& o) const { return pos >= o.pos; }
+    };
+    const_iterator begin() const { return const_iterator(objects.data(), drawOrder().data()); }
+    const_iterator end() const {
+        const std::vector<uint32_t>& ord = drawOrder();
+        return const_iterator(objects.data(), ord.data() + ord.size());
+    }
+    // Leaves through composites and decorators, top-level objects taken in draw order
+    FlatRange flat() const {
+        const std::vector<uint32_t>& ord = drawOrder();
+        return FlatRange(objects.data(), ord.data(), ord.size());
+    }
+    void drawAll() const {
+        std::cout << "=== What the scene contains ===\n";
+        const uint32_t* ord = drawOrder().data();
+        forEachPrefetched(objects.size(), [&](size_t i) { return objects[ord[i]]; },
+                          [](const GraphObject* obj) { obj->draw(); });
+        std::cout << "========================\n\n";
+    }
+    void emitAll(ShapeSink& sink) const { emitRange(sink, 0, objects.size()); }
+    // Top-level objects [first, last) of the draw order only, for splitting work across threads
+    void emitRange(ShapeSink& sink, size_t first, size_t last) const {
+        const std::vector<uint32_t>& ord = drawOrder();
+        last = std::min(last, ord.size());
+        if (first >= last) return;
+        const uint32_t* from = ord.data() + first;
+        forEachPrefetched(last - first, [&](size_t i) { return objects[from[i]]; },
+                          [&](const GraphObject* obj) { obj->emit(sink); });
+    }
+    Bounds bounds() const {
+        Bounds b;
+        forEachPrefetched(objects.size(), [&](size_t i) { return objects[i]; },
+                          [&](const GraphObject* obj) { b.expand(obj->bounds()); });
+        return b;
+    }
+    // Front-to-back rendering: the last object in draw order is on top, so objects are drawn in
+    // reverse and anything hidden behind already drawn filled shapes is skipped.
+    // Objects smaller than lodPixels on screen are drawn as a single dot.
+    void renderFrontToBack(Raster& raster, FrameStats& stats, double lodPixels = 0) const {
+        raster.enableOcclusion();
+        LodSink lod(raster);
+        double lodSize = lodPixels * raster.pixelSize();
+        const std::vector<uint32_t>& ord = drawOrder();
+        for (size_t k = ord.size(); k-- > 0; ) {
+            const GraphObject* obj = objects[ord[k]];
+            Bounds b = obj->bounds();
+            if (!b.intersects(raster.viewport())) { ++stats.culledViewport; continue; }
+            if (raster.occluded(b)) { ++stats.culledOccluded; continue; }
+            if (std::max(b.maxX - b.minX, b.maxY - b.minY) < lodSize) obj->emit(lod);
+            else obj->emit(raster);
+            ++stats.drawn;
+        }
+        raster.collectStats(stats);
+    }
+    void clear() {
+        for (auto* obj : objects) delete obj;
+        objects.clear();
+        invalidateOrder();
+        resetStats();
+    }
+    void simplify(double eps) {
+        for (auto* obj : objects) obj->simplify(eps);
+        recountStats();
+    }
+    // Wraps every group of overlapping objects (circles by their discs, others by their bounds) into a Composite
+    // that keeps its members' draw order and takes the depth of the topmost one
+    void groupOverlapping(unsigned threads = std::thread::hardware_concurrency());
+    // Moves all objects of other to the end of this scene; other is left empty.
+    // Blocks, views and composites move as one pointer each.
+    void merge(Scene& other) {
+        if (&other == this) return;
+        absorbStats(other);
+        if (objects.empty()) objects.swap(other.objects);
+        else {
+            objects.insert(objects.end(), other.objects.begin(), other.objects.end());
+            other.objects.clear();
+        }
+        invalidateOrder();
+        other.invalidateOrder();
+    }
+    // Order-preserving k-way concatenation: shard 0 first, then shard 1, ...; shards are left empty
+    void concat(const std::vector<Scene*>& shards) {
+        std::vector<size_t> offsets(shards.size() + 1, objects.size());
+        for (size_t i = 0; i < shards.size(); ++i)
+            offsets[i + 1] = offsets[i] + (shards[i] && shards[i] != this ? shards[i]->objects.size() : 0);
+        objects.resize(offsets.back());
+        invalidateOrder();
+        for (Scene* shard : shards)
+            if (shard && shard != this) absorbStats(*shard);
+
+        auto copyShard = [&](size_t i) {
+            if (!shards[i] || shards[i] == this) return;
+            std::copy(shards[i]->objects.begin(), shards[i]->objects.end(), objects.begin() + offsets[i]);
+            shards[i]->objects.clear();
+            shards[i]->invalidateOrder();
+        };
+        size_t workers = std::min<size_t>(shards.size(), std::max(1u, std::thread::hardware_concurrency()));
+        if (workers <= 1 || offsets.back() - offsets.front() < 65536) {
+            for (size_t i = 0; i < shards.size(); ++i) copyShard(i);
+            return;
+        }
+        parallelFor(workers, [&](size_t w) { for (size_t i = w; i < shards.size(); i += workers) copyShard(i); });
+    }
+    ~Scene() { clear(); }
+};
+Scene* Scene::instance = nullptr;
+
+// ====================== 3. Abstract Factory ======================
+class AbstractGraphFactory {
+public:
+    virtual ~AbstractGraphFactory() = default;
+    virtual GraphObject* createPoint(double x = 0, double y = 0) = 0;
+    virtual GraphObject* createLine(double x1=0, double y1=0, double x2=0, double y2=0) = 0;
+    virtual GraphObject* createCircle(double cx=0, double cy=0, double r=1) = 0;
+    virtual GraphObject* createPolyline(std::vector<double> coords) = 0;
+    virtual GraphObject* createView(BufferShape shape, std::shared_ptr<const double> data, size_t count, size_t stride = 0) = 0;
+    virtual GraphObject* createView(BufferShape shape, std::shared_ptr<const float> data, size_t count, size_t stride = 0) = 0;
+    virtual Scene* targetScene() const { return Scene::getInstance(); }
+};
+
+class ColorGraphFactory : public AbstractGraphFactory {
+    Scene* target;
+public:
+    ColorGraphFactory(Scene* scene = nullptr) : target(scene) {}
+    Scene* targetScene() const override { return target ? target : Scene::getInstance(); }
+    GraphObject* createPoint(double x = 0, double y = 0) override {
+        auto* p = new Point(x, y, true); targetScene()->addObject(p); return p;
+    }
+    GraphObject* createLine(double x1=0, double y1=0, double x2=0, double y2=0) override {
+        auto* l = new Line(x1,y1,x2,y2,true); targetScene()->addObject(l); return l;
+    }
+    GraphObject* createCircle(double cx=0, double cy=0, double r=1) override {
+        auto* c = new Circle(cx,cy,r,true); targetScene()->addObject(c); return c;
+    }
+    GraphObject* createPolyline(std::vector<double> coords) override {
+        auto* p = new Polyline(std::move(coords), true); targetScene()->addObject(p); return p;
+    }
+    GraphObject* createView(BufferShape shape, std::shared_ptr<const double> data, size_t count, size_t stride = 0) override {
+        auto* v = new BufferView<double>(std::move(data), count, shape, stride, true); targetScene()->addObject(v); return v;
+    }
+    GraphObject* createView(BufferShape shape, std::shared_ptr<const float> data, size_t count, size_t stride = 0) override {
+        auto* v = new BufferView<float>(std::move(data), count, shape, stride, true); targetScene()->addObject(v); return v;
+    }
+};
+
+// ====================== 4. Making Adapter(Wrapper) ======================
+class ThirdPartyTriangle {
+    double x1,y1,x2,y2,x3,y3;
+public:
+    ThirdPartyTriangle(double a1=0,double b1=0,double a2=0,double b2=0,double a3=0,double b3=0)
+        : x1(a1),y1(b1),x2(a2),y2(b2),x3(a3),y3(b3) {}
+    void render() const {
+        std::cout << "Third-Party Triangle (" << x1 << "," << y1 << ") (" << x2 << "," << y2
+                  << ") (" << x3 << "," << y3 << ")\n";
+    }
+    void getVertices(double* out) const {
+        out[0] = x1; out[1] = y1; out[2] = x2; out[3] = y2; out[4] = x3; out[5] = y3;
+    }
+};
+
+class TriangleAdapter : public GraphObject {
+    ThirdPartyTriangle* triangle;
+public:
+    TriangleAdapter(double x1=0, double y1=0, double x2=0, double y2=0, double x3=0, double y3=0, bool colored=true)
+        : GraphObject(colored) {
+        triangle = new ThirdPartyTriangle(x1,y1,x2,y2,x3,y3);
+    }
+    TriangleAdapter(const TriangleAdapter& other)
+        : GraphObject(other), triangle(new ThirdPartyTriangle(*other.triangle)) {}
+    TriangleAdapter& operator=(const TriangleAdapter& other) {
+        if (this != &other) { isColored = other.isColored; *triangle = *other.triangle; }
+        return *this;
+    }
+    ~TriangleAdapter() override { delete triangle; }
+    GraphObject* clone() const override { return new TriangleAdapter(*this); }
+    void draw() const override {
+        std::cout << (isColored ? "Color" : "B/W") << " ";
+        triangle->render();
+    }
+    size_t memorySize() const override { return sizeof(TriangleAdapter); }
+    Bounds bounds() const override {
+        double v[6]; triangle->getVertices(v);
+        Bounds b(v[0], v[1], v[2], v[3]); b.expand(v[4], v[5]);
+        return b;
+    }
+    void emit(ShapeSink& sink) const override {
+        double v[6]; triangle->getVertices(v);
+        sink.triangle(v, isColored);
+    }
+    void translate(double dx, double dy) override {
+        double v[6]; triangle->getVertices(v);
+        *triangle = ThirdPartyTriangle(v[0] + dx, v[1] + dy, v[2] + dx, v[3] + dy, v[4] + dx, v[5] + dy);
+    }
+    void prefetchInner() const override { GRAPH_PREFETCH(triangle); }
+    ShapeKind kind() const override { return ShapeKind::Triangle; }
+};
+
+// Batch adapter: a whole external ThirdPartyTriangle array as one object (array is not owned)
+class TriangleBatchAdapter : public GraphObject {
+    static constexpr size_t kChunk = 256;
+    const ThirdPartyTriangle* triangles;
+    size_t count;
+    double ox = 0, oy = 0;      // translation applied on read, the array stays untouched
+
+    // Unpacks [first, first + n) into interleaved x1,y1,...,x3,y3 records
+    void gather(size_t first, size_t n, double* v) const {
+        for (size_t i = 0; i < n; ++i) triangles[first + i].getVertices(v + 6 * i);
+        if (ox != 0 || oy != 0)
+            for (size_t i = 0; i < 3 * n; ++i) { v[2 * i] += ox; v[2 * i + 1] += oy; }
+    }
+public:
+    TriangleBatchAdapter(const ThirdPartyTriangle* t, size_t n, bool colored = true)
+        : GraphObject(colored), triangles(t), count(t ? n : 0) {}
+    GraphObject* clone() const override { return new TriangleBatchAdapter(*this); }
+    void draw() const override {
+        std::cout << (isColored ? "Color" : "B/W") << " Triangle batch (" << count << " triangles):\n";
+        for (size_t i = 0; i < count; ++i) {
+            std::cout << "   ";
+            if (ox == 0 && oy == 0) { triangles[i].render(); continue; }
+            double v[6]; gather(i, 1, v);
+            ThirdPartyTriangle(v[0], v[1], v[2], v[3], v[4], v[5]).render();
+        }
+    }
+    size_t memorySize() const override { return sizeof(TriangleBatchAdapter); }
+    size_t size() const { return count; }
+    // Gathered chunks go through the SSE2 pair kernel of pathBounds
+    Bounds bounds() const override {
+        double v[6 * kChunk];
+        const double inf = std::numeric_limits<double>::infinity();
+        double lo[2] = {inf, inf}, hi[2] = {-inf, -inf};
+        for (size_t first = 0; first < count; first += kChunk) {
+            size_t n = std::min(kChunk, count - first);
+            gather(first, n, v);
+            expandPairs(v, 3 * n, lo, hi);
+        }
+        Bounds b;
+        if (count) b = Bounds(lo[0], lo[1], hi[0], hi[1]);
+        return b;
+    }
+    bool cheapBounds() const override { return false; }
+    bool countElements(size_t* byKind, size_t*) const override {
+        byKind[int(ShapeKind::Triangle)] += count;
+        return true;
+    }
+    void emit(ShapeSink& sink) const override {
+        double v[6 * kChunk];
+        for (size_t first = 0; first < count; first += kChunk) {
+            size_t n = std::min(kChunk, count - first);
+            gather(first, n, v);
+            sink.triangles(v, n, isColored);
+        }
+    }
+    void translate(double dx, double dy) override { ox += dx; oy += dy; }
+};
+
+// ====================== 5. Making Composite ======================
+class Composite : public GraphObject {
+    std::vector<GraphObject*> children;
+public:
+    Composite(bool colored = true) : GraphObject(colored) {}
+    Composite(const Composite& other) : GraphObject(other) { other.cloneChildrenInto(*this); }
+    Composite& operator=(const Composite& other) {
+        if (this != &other) {
+            Composite copy(other);
+            std::swap(children, copy.children);
+            isColored = other.isColored;
+        }
+        return *this;
+    }
+    ~Composite() override {
+        for (auto* child : children) delete child;
+    }
+    void add(GraphObject* g) { if (g) children.push_back(g); }
+    using const_iterator = std::vector<GraphObject*>::const_iterator;
+    const_iterator begin() const { return children.begin(); }
+    const_iterator end() const { return children.end(); }
+    FlatRange flat() const { return FlatRange(children.data(), nullptr, children.size()); }
+    template <class F>
+    void forEachChild(F f) const {
+        forEachPrefetched(children.size(), [&](size_t i) { return children[i]; }, f);
+    }
+    void cloneChildrenInto(Composite& copy) const {
+        copy.children.reserve(children.size());
+        forEachChild([&](const GraphObject* child) { copy.add(child->clone()); });
+    }
+    GraphObject* clone() const override {
+        auto* copy = new Composite(isColored);
+        cloneChildrenInto(*copy);
+        return copy;
+    }
+    void draw() const override {
+        std::cout << "Composite (contains " << children.size() << " elements):\n";
+        forEachChild([](const GraphObject* child) { child->draw(); });
+    }
+    size_t memorySize() const override { return sizeof(Composite); }
+    Bounds bounds() const override {
+        Bounds b;
+        forEachChild([&](const GraphObject* child) { b.expand(child->bounds()); });
+        return b;
+    }
+    void emit(ShapeSink& sink) const override {
+        sink.beginGroup();
+        forEachChild([&](const GraphObject* child) { child->emit(sink); });
+        sink.endGroup();
+    }
+    void prefetchInner() const override { GRAPH_PREFETCH(children.data()); }
+    ShapeKind kind() const override { return ShapeKind::Composite; }
+    bool cheapBounds() const override {
+        return std::all_of(children.begin(), children.end(), [](const GraphObject* c) { return c->cheapBounds(); });
+    }
+    void translate(double dx, double dy) override {
+        for (auto* child : children) child->translate(dx, dy);
+    }
+    size_t childCount() const override { return children.size(); }
+    const GraphObject* child(size_t i) const override { return children[i]; }
+    void simplify(double eps) override {
+        for (auto* child : children) child->simplify(eps);
+    }
+};
+
+// ====================== 6. Making Decorator (triangle coloring) ======================
+class FilledDecorator : public GraphObject {
+    GraphObject* component;
+    bool filled = true;     // switched off, the decorator draws its component as is
+public:
+    FilledDecorator(GraphObject* c)
+        : GraphObject(c->getColor()), component(c) { setDepth(c->getLayer(), c->getZIndex()); }
+    FilledDecorator(const FilledDecorator& other)
+        : GraphObject(other), component(other.component->clone()), filled(other.filled) {}
+    FilledDecorator& operator=(const FilledDecorator& other) {
+        if (this != &other) {
+            GraphObject* copy = other.component->clone();
+            delete component;
+            component = copy;
+            isColored = other.isColored;
+            filled = other.filled;
+        }
+        return *this;
+    }
+    ~FilledDecorator() override { delete component; }
+    GraphObject* clone() const override { return new FilledDecorator(*this); }
+    void draw() const override {
+        component->draw();
+        if (filled) std::cout << "   >>> This graphic object is filled! <<<\n";
+    }
+    size_t memorySize() const override { return sizeof(FilledDecorator); }
+    Bounds bounds() const override { return component->bounds(); }
+    bool cheapBounds() const override { return component->cheapBounds(); }
+    void emit(ShapeSink& sink) const override {
+        if (filled) sink.beginFill();
+        component->emit(sink);
+        if (filled) sink.endFill();
+    }
+    bool isFilled() const { return filled; }
+    void setFilled(bool on) { filled = on; }
+    void translate(double dx, double dy) override { component->translate(dx, dy); }
+    const GraphObject* decorated() const override { return component; }
+    void prefetchInner() const override { GRAPH_PREFETCH(component); }
+    bool addsFill() const override { return filled; }
+    void simplify(double eps) override { component->simplify(eps); }
+};
+
+// ====================== Bulk Prototype: N copies into contiguous storage ======================
+// One allocation for all copies; the block is added to the Scene as a single object
+template <typename T>
+class CloneBlock : public GraphObject {
+    static_assert(std::is_base_of<GraphObject, T>::value, "CloneBlock holds concrete graphic objects");
+    std::vector<T> items;
+public:
+    CloneBlock(bool colored = true) : GraphObject(colored) {}
+
+    // Appends n copies of proto, copy i shifted by (dx[i], dy[i]) when offsets are given
+    void cloneN(const T& proto, size_t n, const double* dx = nullptr, const double* dy = nullptr) {
+        size_t first = items.size();
+        items.resize(first + n, proto);
+        if (!dx && !dy) return;
+        T* out = items.data() + first;
+        for (size_t i = 0; i < n; ++i)
+            out[i].T::translate(dx ? dx[i] : 0.0, dy ? dy[i] : 0.0);     // static dispatch, no vcall
+    }
+    size_t size() const { return items.size(); }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+
+    GraphObject* clone() const override { return new CloneBlock(*this); }
+    void draw() const override {
+        std::cout << "Clone block (contains " << items.size() << " elements):\n";
+        for (const auto& item : items) item.T::draw();
+    }
+    size_t memorySize() const override { return sizeof(CloneBlock) + items.capacity() * sizeof(T); }
+    Bounds bounds() const override {
+        Bounds b;
+        for (const auto& item : items) b.expand(item.T::bounds());
+        return b;
+    }
+    bool cheapBounds() const override { return false; }
+    // Block of composites counts the composites only
+    bool countElements(size_t* byKind, size_t*) const override {
+        if (!items.empty()) byKind[int(items.front().T::kind())] += items.size();
+        return true;
+    }
+    void emit(ShapeSink& sink) const override {
+        for (const auto& item : items) item.T::emit(sink);
+    }
+    void translate(double dx, double dy) override {
+        for (auto& item : items) item.T::translate(dx, dy);
+    }
+    size_t childCount() const override { return items.size(); }
+    const GraphObject* child(size_t i) const override { return &items[i]; }
+    void simplify(double eps) override {
+        for (auto& item : items) item.T::simplify(eps);
+    }
+};
+
+template <typename T>
+CloneBlock<T>* cloneN(const T& proto, size_t n, const double* dx = nullptr, const double* dy = nullptr) {
+    auto* block = new CloneBlock<T>(proto.getColor());
+    block->cloneN(proto, n, dx, dy);
+    return block;
+}
+
+// ====================== Prototype registry ======================
+// Named templates, flattened once at registration so instantiation is a plain clone loop
+class PrototypeRegistry {
+public:
+    typedef size_t TemplateId;
+    static constexpr TemplateId npos = size_t(-1);
+private:
+    struct Template {
+        std::string name;
+        std::vector<GraphObject*> leaves;   // groups expanded, decorated objects kept whole
+        size_t memory = 0;
+        Bounds bounds;
+    };
+    static PrototypeRegistry* instance;
+    std::vector<Template> templates;
+    std::unordered_map<std::string, TemplateId> ids;
+    PrototypeRegistry() = default;
+
+    static void flatten(const GraphObject* g, std::vector<GraphObject*>& out) {
+        size_t n = g->childCount();
+        if (n == 0) { out.push_back(g->clone()); return; }
+        for (size_t i = 0; i < n; ++i) flatten(g->child(i), out);
+    }
+    static void release(Template& t) {
+        for (auto* leaf : t.leaves) delete leaf;
+        t.leaves.clear();
+    }
+public:
+    static PrototypeRegistry* getInstance() {
+        if (!instance) instance = new PrototypeRegistry();
+        return instance;
+    }
+    // Stores a flattened copy of proto; re-registering a name replaces the template
+    TemplateId registerTemplate(const std::string& name, const GraphObject& proto) {
+        auto it = ids.find(name);
+        TemplateId id = it != ids.end() ? it->second : templates.size();
+        if (id == templates.size()) { templates.emplace_back(); ids[name] = id; }
+        Template& t = templates[id];
+        release(t);
+        t.name = name;
+        flatten(&proto, t.leaves);
+        t.memory = 0;
+        t.bounds = Bounds();
+        for (auto* leaf : t.leaves) { t.memory += leaf->memorySize(); t.bounds.expand(leaf->bounds()); }
+        return id;
+    }
+    TemplateId find(const std::string& name) const {
+        auto it = ids.find(name);
+        return it != ids.end() ? it->second : npos;
+    }
+    size_t leafCount(TemplateId id) const { return templates[id].leaves.size(); }
+    const GraphObject* leaf(TemplateId id, size_t i) const { return templates[id].leaves[i]; }
+    size_t memorySize(TemplateId id) const { return templates[id].memory; }
+    Bounds bounds(TemplateId id) const { return templates[id].bounds; }
+
+    // Clones go straight into the scene, shifted by (dx, dy); returns the number of objects added
+    size_t instantiate(TemplateId id, Scene* scene, double dx = 0, double dy = 0) const {
+        if (id >= templates.size() || !scene) return 0;
+        const Template& t = templates[id];
+        scene->reserve(t.leaves.size());
+        for (const auto* leaf : t.leaves) {
+            GraphObject* copy = leaf->clone();
+            if (dx != 0 || dy != 0) copy->translate(dx, dy);
+            scene->addObject(copy);
+        }
+        return t.leaves.size();
+    }
+    size_t instantiate(const std::string& name, Scene* scene, double dx = 0, double dy = 0) const {
+        return instantiate(find(name), scene, dx, dy);
+    }
+    // Same clones gathered in a Composite instead of added to a scene; nullptr for unknown names
+    Composite* create(TemplateId id, double dx = 0, double dy = 0) const {
+        if (id >= templates.size()) return nullptr;
+        auto* group = new Composite(true);
+        for (const auto* leaf : templates[id].leaves) {
+            GraphObject* copy = leaf->clone();
+            if (dx != 0 || dy != 0) copy->translate(dx, dy);
+            group->add(copy);
+        }
+        return group;
+    }
+    void clear() {
+        for (auto& t : templates) release(t);
+        templates.clear();
+        ids.clear();
+    }
+    ~PrototypeRegistry() { clear(); }
+};
+PrototypeRegistry* PrototypeRegistry::instance = nullptr;
+
+// ====================== Metrics (Prometheus text format) ======================
+// Every thread counts into its own block, written only by that thread, so instrumented hot paths
+// do plain relaxed stores and never share a cache line. When a thread exits its block is folded
+// into the retired totals and freed, so short-lived worker pools do not add up. A scrape sums
+// the retired totals and the blocks of running threads. Rates (objects/s, bytes/s) come from
+// the _total counters.
+class Metrics {
+public:
+    enum Counter { ObjectsBuilt, ParseBytes, BuildCalls, ExportCalls, LazyCacheHits, LazyCacheMisses, kCounters };
+    enum Histogram { BuildSeconds, ExportSeconds, kHistograms };
+private:
+    static constexpr int kBuckets = 11;     // plus +Inf
+    static constexpr double kBucketBounds[kBuckets] = {1e-4, 2.5e-4, 1e-3, 2.5e-3, 1e-2, 2.5e-2, 0.1, 0.25, 1, 2.5, 10};
+    struct alignas(64) Block {
+        std::atomic<uint64_t> counters[kCounters]{};
+        std::atomic<uint64_t> buckets[kHistograms][kBuckets + 1]{};
+        std::atomic<uint64_t> nanos[kHistograms]{};
+    };
+    mutable std::mutex blocksMutex;
+    std::vector<std::unique_ptr<Block>> blocks;     // of running threads
+    Block retired;                                  // counts of finished threads, under blocksMutex
+    std::atomic<const Scene*> watched{nullptr};
+    std::mutex writerMutex;
+    std::condition_variable writerWake;
+    std::thread writer;
+    bool writerStop = false;
+
+    Metrics() = default;
+    static void bump(std::atomic<uint64_t>& v, uint64_t n) {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void addBlock(Block& to, const Block& from) {
+        for (int c = 0; c < kCounters; ++c) bump(to.counters[c], from.counters[c].load(std::memory_order_relaxed));
+        for (int h = 0; h < kHistograms; ++h) {
+            for (int i = 0; i <= kBuckets; ++i) bump(to.buckets[h][i], from.buckets[h][i].load(std::memory_order_relaxed));
+            bump(to.nanos[h], from.nanos[h].load(std::memory_order_relaxed));
+        }
+    }
+    // Owns the calling thread's block and retires it when the thread exits
+    struct BlockOwner {
+        Metrics* metrics = nullptr;
+        Block* block = nullptr;
+        ~BlockOwner() { if (block) metrics->retire(block); }
+    };
+    void retire(Block* block) {
+        std::lock_guard<std::mutex> lock(blocksMutex);
+        addBlock(retired, *block);
+        auto it = std::find_if(blocks.begin(), blocks.end(), [&](const std::unique_ptr<Block>& b) { return b.get() == block; });
+        if (it == blocks.end()) return;
+        std::swap(*it, blocks.back());
+        blocks.pop_back();
+    }
+    Block& local() {
+        thread_local BlockOwner owner;
+        if (!owner.block) {
+            std::lock_guard<std::mutex> lock(blocksMutex);
+            blocks.push_back(std::unique_ptr<Block>(new Block()));
+            owner.block = blocks.back().get();
+            owner.metrics = this;
+        }
+        return *owner.block;
+    }
+public:
+    static Metrics* getInstance() {
+        static Metrics* instance = new Metrics();   // thread-safe init: worker threads count too
+        return instance;
+    }
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    void add(Counter c, uint64_t n = 1) { bump(local().counters[c], n); }
+    void observe(Histogram h, double seconds) {
+        Block& b = local();
+        int i = 0;
+        while (i < kBuckets && seconds > kBucketBounds[i]) ++i;
+        bump(b.buckets[h][i], 1);
+        bump(b.nanos[h], uint64_t(std::max(0.0, seconds) * 1e9));
+    }
+    uint64_t total(Counter c) const {
+        std::lock_guard<std::mutex> lock(blocksMutex);
+        uint64_t sum = retired.counters[c].load(std::memory_order_relaxed);
+        for (const auto& b : blocks) sum += b->counters[c].load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    // Scene whose statistics are published as gauges; startWriting() picks the global one
+    void watchScene(const Scene* scene) { watched.store(scene, std::memory_order_release); }
+
+    // Scrape in the text exposition format
+    void write(std::ostream& out) const {
+        static const char* counterNames[kCounters][2] = {
+            {"graph_objects_built_total", "Graphic objects created by facade builds and lazy blocks."},
+            {"graph_parse_bytes_total", "Command string bytes handed to the facade."},
+            {"graph_build_calls_total", "Facade build calls."},
+            {"graph_export_calls_total", "Facade export calls."},
+            {"graph_lazy_cache_hits_total", "Lazy block lookups served from the cache."},
+            {"graph_lazy_cache_misses_total", "Lazy block lookups that built an object."}};
+        static const char* histogramNames[kHistograms][2] = {
+            {"graph_build_seconds", "Latency of facade build calls."},
+            {"graph_export_seconds", "Latency of facade export calls."}};
+        Block sum;
+        {
+            std::lock_guard<std::mutex> lock(blocksMutex);
+            addBlock(sum, retired);
+            for (const auto& b : blocks) addBlock(sum, *b);
+        }
+        uint64_t counters[kCounters], buckets[kHistograms][kBuckets + 1], nanos[kHistograms];
+        for (int c = 0; c < kCounters; ++c) counters[c] = sum.counters[c].load(std::memory_order_relaxed);
+        for (int h = 0; h < kHistograms; ++h) {
+            for (int i = 0; i <= kBuckets; ++i) buckets[h][i] = sum.buckets[h][i].load(std::memory_order_relaxed);
+            nanos[h] = sum.nanos[h].load(std::memory_order_relaxed);
+        }
+        for (int c = 0; c < kCounters; ++c)
+            out << "# HELP " << counterNames[c][0] << ' ' << counterNames[c][1] << "\n# TYPE " << counterNames[c][0]
+                << " counter\n" << counterNames[c][0] << ' ' << counters[c] << '\n';
+        for (int h = 0; h < kHistograms; ++h) {
+            const char* name = histogramNames[h][0];
+            out << "# HELP " << name << ' ' << histogramNames[h][1] << "\n# TYPE " << name << " histogram\n";
+            uint64_t cumulative = 0;
+            for (int i = 0; i <= kBuckets; ++i) {
+                cumulative += buckets[h][i];
+                out << name << "_bucket{le=\"";
+                if (i < kBuckets) out << kBucketBounds[i]; else out << "+Inf";
+                out << "\"} " << cumulative << '\n';
+            }
+            out << name << "_sum " << double(nanos[h]) / 1e9 << '\n' << name << "_count " << cumulative << '\n';
+        }
+        uint64_t lookups = counters[LazyCacheHits] + counters[LazyCacheMisses];
+        out << "# TYPE graph_lazy_cache_hit_ratio gauge\ngraph_lazy_cache_hit_ratio "
+            << (lookups ? double(counters[LazyCacheHits]) / double(lookups) : 0.0) << '\n';
+        const Scene* scene = watched.load(std::memory_order_acquire);
+        if (!scene) return;
+        SceneStats st = scene->stats();
+        const std::pair<const char*, double> gauges[] = {
+            {"graph_scene_objects", double(st.objects)},
+            {"graph_scene_shapes", double(st.shapes)},
+            {"graph_scene_memory_bytes", double(st.memory)},
+            {"graph_scene_fill_ratio", st.fillRatio()}};
+        for (const auto& g : gauges)
+            out << "# TYPE " << g.first << " gauge\n" << g.first << ' ' << g.second << '\n';
+    }
+    // For the node exporter textfile collector: written to a temporary file, then renamed so the
+    // collector never reads half a file
+    bool writeTextfile(const std::string& path) const {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            if (!out) return false;
+            write(out);
+            if (!out) return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        return !ec;
+    }
+    // Rewrites the textfile every period from a background thread until stopWriting()
+    void startWriting(const std::string& path, std::chrono::milliseconds period) {
+        stopWriting();
+        if (!watched.load(std::memory_order_acquire)) watchScene(Scene::getInstance());
+        writerStop = false;
+        writer = std::thread([this, path, period] {
+            std::unique_lock<std::mutex> lock(writerMutex);
+            while (!writerStop) {
+                writeTextfile(path);
+                writerWake.wait_for(lock, period, [this] { return writerStop; });
+            }
+            writeTextfile(path);
+        });
+    }
+    void stopWriting() {
+        if (!writer.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(writerMutex);
+            writerStop = true;
+        }
+        writerWake.notify_all();
+        writer.join();
+    }
+};
+// ====================== Lazy command buffer ======================
+// A quick structural pass records where each DSL command starts and what it is; objects
+// are built only when something touches them and then stay cached. The index follows
+// buildSceneFromString: a T, G or M waits for a possible F and is added after later P/C/L,
+// an I adds one entry per template leaf, and Z targets the same object. Inside the block
+// commands draw in Z order; the block as a whole sits in the scene at its own depth.
+class LazyCommandBlock : public GraphObject {
+public:
+    struct Entry {
+        size_t offset;
+        uint32_t length;
+        char type;              // upper-case command letter
+        bool filled;            // followed by F
+        int16_t layer, z;       // from a following Z, or the template leaf's own depth
+        bool hasDepth;
+        uint32_t part = 0;      // leaf of an I template
+        ShapeKind kind = ShapeKind::Other;
+    };
+private:
+    std::shared_ptr<const std::string> text;
+    std::vector<Entry> entries;
+    std::unique_ptr<std::atomic<GraphObject*>[]> cache;
+    std::vector<uint32_t> drawOrder;        // entry indices by depth; empty when no command has a Z
+    mutable std::atomic<size_t> hits{0}, misses{0};
+    double ox = 0, oy = 0;
+
+    static std::vector<double> numbers(const char* p, const char* end) {
+        std::vector<double> values;
+        while (p < end) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) ++p;
+            if (p >= end) break;
+            double v;
+            auto res = std::from_chars(p, end, v);
+            if (res.ec != std::errc()) break;
+            values.push_back(v);
+            p = res.ptr;
+        }
+        return values;
+    }
+    // "I name[,dx,dy]" from just after the letter
+    static PrototypeRegistry::TemplateId templateRef(const char* p, const char* end, double& dx, double& dy) {
+        const char* nameEnd = std::find(p, end, ',');
+        std::string name(p, nameEnd);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+        std::vector<double> d = numbers(nameEnd, end);
+        dx = d.size() > 0 ? d[0] : 0;
+        dy = d.size() > 1 ? d[1] : 0;
+        return PrototypeRegistry::getInstance()->find(name);
+    }
+    GraphObject* build(const Entry& e) const {
+        const char* p = text->data() + e.offset + 1;
+        const char* end = text->data() + e.offset + e.length;
+        GraphObject* obj = nullptr;
+        if (e.type == 'I') {
+            double dx, dy;
+            PrototypeRegistry* registry = PrototypeRegistry::getInstance();
+            PrototypeRegistry::TemplateId id = templateRef(p, end, dx, dy);
+            if (id != PrototypeRegistry::npos && e.part < registry->leafCount(id)) {
+                obj = registry->leaf(id, e.part)->clone();
+                if (dx != 0 || dy != 0) obj->translate(dx, dy);
+            }
+        } else {
+            std::vector<double> v = numbers(p, end);
+            v.resize(std::max<size_t>(v.size(), e.type == 'T' ? 6 : e.type == 'C' ? 3 : 2), 0.0);
+            switch (e.type) {
+            case 'P': obj = new Point(v[0], v[1], isColored); break;
+            case 'C': obj = new Circle(v[0], v[1], v[2], isColored); break;
+            case 'T': obj = new TriangleAdapter(v[0], v[1], v[2], v[3], v[4], v[5], isColored); break;
+            case 'L': obj = new Polyline(std::move(v), isColored); break;
+            case 'G': obj = new Polygon(std::move(v), isColored); break;
+            case 'M': obj = TriangleMesh::weld(v.data(), v.size() / 6, 1e-9, isColored); break;
+            }
+        }
+        if (!obj) obj = new Composite(isColored);       // template changed since indexing: an empty group keeps indices stable
+        if (e.hasDepth) obj->setDepth(e.layer, e.z);
+        if (e.filled && e.type != 'I') obj = new FilledDecorator(obj);     // template leaves come decorated
+        if (ox != 0 || oy != 0) obj->translate(ox, oy);
+        return obj;
+    }
+public:
+    LazyCommandBlock(std::shared_ptr<const std::string> source, std::vector<Entry> index, bool colored = true)
+        : GraphObject(colored), text(std::move(source)), entries(std::move(index)),
+          cache(new std::atomic<GraphObject*>[entries.size()]) {
+        for (size_t i = 0; i < entries.size(); ++i) cache[i].store(nullptr, std::memory_order_relaxed);
+        if (std::none_of(entries.begin(), entries.end(), [](const Entry& e) { return e.hasDepth; })) return;
+        auto key = [](const Entry& e) {
+            return e.hasDepth ? (uint32_t(e.layer + 32768) << 16) | uint32_t(e.z + 32768) : 0x80008000u;
+        };
+        drawOrder.resize(entries.size());
+        std::iota(drawOrder.begin(), drawOrder.end(), 0u);
+        std::stable_sort(drawOrder.begin(), drawOrder.end(),
+                         [&](uint32_t a, uint32_t b) { return key(entries[a]) < key(entries[b]); });
+    }
+    LazyCommandBlock(const LazyCommandBlock& other)
+        : LazyCommandBlock(other.text, other.entries, other.isColored) {
+        ox = other.ox; oy = other.oy;
+        setDepth(other.getLayer(), other.getZIndex());
+    }
+    LazyCommandBlock& operator=(const LazyCommandBlock&) = delete;
+    ~LazyCommandBlock() override {
+        for (size_t i = 0; i < entries.size(); ++i) delete cache[i].load(std::memory_order_relaxed);
+    }
+
+    // Structural pass: splits on ';' and records each command in the order buildSceneFromString adds them
+    static LazyCommandBlock* index(std::shared_ptr<const std::string> source, bool colored = true) {
+        std::vector<Entry> entries;
+        Entry pending{};                // T, G or M waiting for a possible F
+        bool hasPending = false;
+        auto flush = [&] {
+            if (hasPending) entries.push_back(pending);
+            hasPending = false;
+        };
+        PrototypeRegistry* registry = PrototypeRegistry::getInstance();
+        const char* base = source->data();
+        const char* end = base + source->size();
+        for (const char* p = base; p < end; ) {
+            const char* stop = static_cast<const char*>(std::memchr(p, ';', size_t(end - p)));
+            if (!stop) stop = end;
+            while (p < stop && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+            if (p < stop) {
+                char type = char(std::toupper(static_cast<unsigned char>(*p)));
+                Entry e{size_t(p - base), uint32_t(stop - p), type, false, 0, 0, false};
+                e.kind = type == 'P' ? ShapeKind::Point : type == 'C' ? ShapeKind::Circle : type == 'T' ? ShapeKind::Triangle
+                       : type == 'L' || type == 'G' ? ShapeKind::Polyline : ShapeKind::Other;
+                if (type == 'F') {
+                    if (hasPending) { pending.filled = true; flush(); }
+                } else if (type == 'Z') {
+                    Entry* target = hasPending ? &pending : entries.empty() ? nullptr : &entries.back();
+                    std::vector<double> v = numbers(p + 1, stop);
+                    if (target && !v.empty()) {
+                        target->layer = int16_t(v.size() > 1 ? GraphObject::depthValue(v[0]) : target->layer);
+                        target->z = int16_t(GraphObject::depthValue(v.back()));
+                        target->hasDepth = true;
+                    }
+                } else if (type == 'T' || type == 'G' || type == 'M') {
+                    flush();
+                    pending = e;
+                    hasPending = true;
+                } else if (type == 'I') {
+                    double dx, dy;
+                    PrototypeRegistry::TemplateId id = templateRef(p + 1, stop, dx, dy);
+                    size_t leaves = id != PrototypeRegistry::npos ? registry->leafCount(id) : 0;
+                    for (size_t k = 0; k < leaves; ++k) {
+                        const GraphObject* leaf = registry->leaf(id, k);
+                        e.layer = int16_t(leaf->getLayer());
+                        e.z = int16_t(leaf->getZIndex());
+                        e.hasDepth = true;
+                        e.part = uint32_t(k);
+                        e.filled = false;
+                        for (; leaf->decorated(); leaf = leaf->decorated()) e.filled = e.filled || leaf->addsFill();
+                        e.kind = leaf->kind();
+                        entries.push_back(e);
+                    }
+                } else if (type == 'P' || type == 'C' || type == 'L') {
+                    entries.push_back(e);
+                }
+            }
+            p = stop + 1;
+        }
+        flush();
+        return new LazyCommandBlock(std::move(source), std::move(entries), colored);
+    }
+
+    size_t size() const { return entries.size(); }
+    const Entry& entry(size_t i) const { return entries[i]; }
+    // Entry drawn at position i
+    size_t drawIndex(size_t i) const { return drawOrder.empty() ? i : drawOrder[i]; }
+    // Builds entry i on first use; concurrent callers race with CAS and the loser drops its copy
+    GraphObject* get(size_t i) const {
+        GraphObject* obj = cache[i].load(std::memory_order_acquire);
+        if (obj) {
+            hits.fetch_add(1, std::memory_order_relaxed);
+            Metrics::getInstance()->add(Metrics::LazyCacheHits);
+            return obj;
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+        Metrics::getInstance()->add(Metrics::LazyCacheMisses);
+        Metrics::getInstance()->add(Metrics::ObjectsBuilt);
+        GraphObject* built = build(entries[i]);
+        if (cache[i].compare_exchange_strong(obj, built, std::memory_order_acq_rel)) return built;
+        delete built;
+        return obj;
+    }
+    size_t materializedCount() const {
+        size_t n = 0;
+        for (size_t i = 0; i < entries.size(); ++i) n += cache[i].load(std::memory_order_relaxed) != nullptr;
+        return n;
+    }
+    size_t cacheHits() const { return hits.load(std::memory_order_relaxed); }
+    size_t cacheMisses() const { return misses.load(std::memory_order_relaxed); }
+
+    GraphObject* clone() const override { return new LazyCommandBlock(*this); }
+    void draw() const override {
+        for (size_t i = 0; i < entries.size(); ++i) get(drawIndex(i))->draw();
+    }
+    size_t memorySize() const override {
+        size_t bytes = sizeof(LazyCommandBlock) + entries.capacity() * (sizeof(Entry) + sizeof(GraphObject*))
+                     + drawOrder.capacity() * sizeof(uint32_t);
+        for (size_t i = 0; i < entries.size(); ++i)
+            if (GraphObject* obj = cache[i].load(std::memory_order_acquire)) bytes += obj->memorySize();
+        return bytes;
+    }
+    Bounds bounds() const override {
+        Bounds b;
+        for (size_t i = 0; i < entries.size(); ++i) b.expand(get(i)->bounds());
+        return b;
+    }
+    bool cheapBounds() const override { return false; }
+    // Counted from the index by command letter or template leaf, nothing is built; a mesh counts
+    // as one shape
+    bool countElements(size_t* byKind, size_t* filledByKind) const override {
+        for (const Entry& e : entries) {
+            ++byKind[int(e.kind)];
+            if (e.filled) ++filledByKind[int(e.kind)];
+        }
+        return true;
+    }
+    void emit(ShapeSink& sink) const override {
+        for (size_t i = 0; i < entries.size(); ++i) get(drawIndex(i))->emit(sink);
+    }
+    // Applied to built objects now and to the rest when they are built
+    void translate(double dx, double dy) override {
+        ox += dx; oy += dy;
+        for (size_t i = 0; i < entries.size(); ++i)
+            if (GraphObject* obj = cache[i].load(std::memory_order_acquire)) obj->translate(dx, dy);
+    }
+    size_t childCount() const override { return entries.size(); }
+    const GraphObject* child(size_t i) const override { return get(drawIndex(i)); }
+    void simplify(double eps) override {
+        for (size_t i = 0; i < entries.size(); ++i) get(i)->simplify(eps);
+    }
+};
+
+// ====================== Streaming exporters (SVG, JSON) ======================
+// Output in fixed-size chunks. With a stream every full chunk is written out at once,
+// so memory stays bounded; without one the chunks are kept for ordered concatenation.
+class ChunkedWriter {
+public:
+    static constexpr size_t kChunkSize = 64 * 1024;
+private:
+    std::ostream* out;
+    std::vector<std::vector<char>> kept;
+    std::vector<char> chunk;
+    size_t total = 0;
+
+    void spill() {
+        if (chunk.empty()) return;
+        if (out) { out->write(chunk.data(), std::streamsize(chunk.size())); chunk.clear(); return; }
+        kept.push_back(std::move(chunk));
+        chunk = std::vector<char>();
+        chunk.reserve(kChunkSize);
+    }
+public:
+    explicit ChunkedWriter(std::ostream* stream = nullptr) : out(stream) { chunk.reserve(kChunkSize); }
+    ChunkedWriter(const ChunkedWriter&) = delete;
+    ChunkedWriter& operator=(const ChunkedWriter&) = delete;
+    ~ChunkedWriter() { if (out) flush(); }
+
+    void put(const char* s, size_t n) {
+        total += n;
+        while (n) {
+            size_t k = std::min(n, kChunkSize - chunk.size());
+            chunk.insert(chunk.end(), s, s + k);
+            s += k; n -= k;
+            if (chunk.size() == kChunkSize) spill();
+        }
+    }
+    void put(const char* s) { put(s, std::strlen(s)); }
+    void put(char c) { put(&c, 1); }
+    void number(double v) {
+        char tmp[32];
+        auto res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+        put(tmp, size_t(res.ptr - tmp));
+    }
+    void flush() {
+        if (!out) return;
+        spill();
+        out->flush();
+    }
+    size_t size() const { return total; }
+    // Appends everything this writer holds to dst
+    void appendTo(ChunkedWriter& dst) const {
+        for (const auto& c : kept) dst.put(c.data(), c.size());
+        dst.put(chunk.data(), chunk.size());
+    }
+};
+
+class SvgExporter : public ShapeSink {
+    ChunkedWriter& w;
+    int fillDepth = 0;
+
+    void style(bool colored, bool closed) {
+        const char* color = colored ? "steelblue" : "black";
+        w.put(" stroke=\""); w.put(color);
+        w.put("\" fill=\""); w.put(closed && fillDepth > 0 ? color : "none");
+        w.put("\"/>\n");
+    }
+    void attr(const char* name, double v) {
+        w.put(' '); w.put(name); w.put("=\""); w.number(v); w.put('"');
+    }
+public:
+    explicit SvgExporter(ChunkedWriter& writer) : w(writer) {}
+    void begin(const Bounds& view) {
+        w.put("<svg xmlns=\"http://www.w3.org/2000/svg\"");
+        if (!view.empty()) {
+            w.put(" viewBox=\"");
+            w.number(view.minX); w.put(' '); w.number(view.minY); w.put(' ');
+            w.number(view.maxX - view.minX); w.put(' '); w.number(view.maxY - view.minY);
+            w.put('"');
+        }
+        w.put(">\n");
+    }
+    void end() { w.put("</svg>\n"); }
+
+    void point(double x, double y, bool colored) override {
+        w.put("<circle"); attr("cx", x); attr("cy", y); w.put(" r=\"1\"");
+        fillDepth++; style(colored, true); fillDepth--;
+    }
+    void line(double x1, double y1, double x2, double y2, bool colored) override {
+        w.put("<line"); attr("x1", x1); attr("y1", y1); attr("x2", x2); attr("y2", y2);
+        style(colored, false);
+    }
+    void circle(double cx, double cy, double r, bool colored) override {
+        w.put("<circle"); attr("cx", cx); attr("cy", cy); attr("r", r);
+        style(colored, true);
+    }
+    void triangle(const double* v, bool colored) override {
+        w.put("<polygon points=\"");
+        for (int k = 0; k < 6; k += 2) {
+            if (k) w.put(' ');
+            w.number(v[k]); w.put(','); w.number(v[k + 1]);
+        }
+        w.put('"');
+        style(colored, true);
+    }
+    void polyline(const double* xy, size_t n, bool closed, bool colored) override {
+        w.put(closed ? "<polygon points=\"" : "<polyline points=\"");
+        for (size_t i = 0; i < n; ++i) {
+            if (i) w.put(' ');
+            w.number(xy[2 * i]); w.put(','); w.number(xy[2 * i + 1]);
+        }
+        w.put('"');
+        style(colored, closed);
+    }
+    void beginFill() override { ++fillDepth; }
+    void endFill() override { --fillDepth; }
+    void beginGroup() override { w.put("<g>\n"); }
+    void endGroup() override { w.put("</g>\n"); }
+};
+
+class JsonExporter : public ShapeSink {
+    ChunkedWriter& w;
+    int fillDepth = 0;
+    std::vector<bool> first{true};      // per open array: nothing written yet
+
+    void open(const char* type) {
+        if (!first.back()) w.put(',');
+        first.back() = false;
+        w.put("{\"type\":\""); w.put(type); w.put('"');
+    }
+    void field(const char* name, double v) {
+        w.put(",\""); w.put(name); w.put("\":"); w.number(v);
+    }
+    void close(bool colored) {
+        w.put(colored ? ",\"colored\":true" : ",\"colored\":false");
+        w.put(fillDepth > 0 ? ",\"filled\":true}" : ",\"filled\":false}");
+    }
+public:
+    explicit JsonExporter(ChunkedWriter& writer) : w(writer) {}
+    bool wroteAny() const { return !first.front(); }
+    void begin() { w.put('['); }
+    void end() { w.put("]\n"); }
+
+    void point(double x, double y, bool colored) override {
+        open("point"); field("x", x); field("y", y); close(colored);
+    }
+    void line(double x1, double y1, double x2, double y2, bool colored) override {
+        open("line"); field("x1", x1); field("y1", y1); field("x2", x2); field("y2", y2); close(colored);
+    }
+    void circle(double cx, double cy, double r, bool colored) override {
+        open("circle"); field("cx", cx); field("cy", cy); field("r", r); close(colored);
+    }
+    void triangle(const double* v, bool colored) override {
+        open("triangle"); w.put(",\"points\":[");
+        for (int k = 0; k < 6; ++k) { if (k) w.put(','); w.number(v[k]); }
+        w.put(']'); close(colored);
+    }
+    void polyline(const double* xy, size_t n, bool closed, bool colored) override {
+        open(closed ? "polygon" : "polyline"); w.put(",\"points\":[");
+        for (size_t k = 0; k < 2 * n; ++k) { if (k) w.put(','); w.number(xy[k]); }
+        w.put(']'); close(colored);
+    }
+    void beginFill() override { ++fillDepth; }
+    void endFill() override { --fillDepth; }
+    void beginGroup() override {
+        open("group"); w.put(",\"children\":[");
+        first.push_back(true);
+    }
+    void endGroup() override {
+        first.pop_back();
+        w.put("]}");
+    }
+};
+
+// Renders objects [0, n) in parts of kPartSize on threads workers and hands every finished part
+// to consume in scene order on the calling thread. Workers stay at most 2 * threads parts ahead
+// of the writer, so only that many parts are held in memory however large the scene is.
+template <typename Render, typename Consume>
+void exportInOrder(size_t n, unsigned threads, Render render, Consume consume) {
+    const size_t kPartSize = 1024;
+    struct Part {
+        std::unique_ptr<ChunkedWriter> out;
+        bool nonEmpty = false;
+    };
+    size_t parts = (n + kPartSize - 1) / kPartSize;
+    size_t window = size_t(threads) * 2;
+    std::vector<Part> slots(window);            // part k waits in slot k % window
+    std::mutex m;
+    std::condition_variable cv;
+    size_t next = 0, written = 0;
+
+    auto work = [&] {
+        for (;;) {
+            size_t k;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return next >= parts || next < written + window; });
+                if (next >= parts) return;
+                k = next++;
+            }
+            Part part;
+            part.out.reset(new ChunkedWriter());
+            part.nonEmpty = render(*part.out, k * kPartSize, std::min(n, (k + 1) * kPartSize));
+            {
+                std::lock_guard<std::mutex> lock(m);
+                slots[k % window] = std::move(part);
+            }
+            cv.notify_all();
+        }
+    };
+    // worker 0 (the caller) consumes the parts in order while the others render them
+    parallelFor(size_t(threads) + 1, [&](size_t w) {
+        if (w) { work(); return; }
+        for (size_t k = 0; k < parts; ++k) {
+            Part part;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&] { return bool(slots[k % window].out); });
+                part = std::move(slots[k % window]);
+                ++written;
+            }
+            cv.notify_all();
+            consume(*part.out, part.nonEmpty);
+        }
+    });
+}
+
+// Exports the scene on threads workers; parts are rendered independently and written in scene order
+inline void exportSvg(const Scene& scene, std::ostream& out, unsigned threads = 1) {
+    ChunkedWriter w(&out);
+    SvgExporter head(w);
+    head.begin(scene.bounds());
+    size_t n = scene.size();
+    threads = unsigned(std::max<size_t>(1, std::min<size_t>(threads, n / 1024)));
+    if (threads == 1) {
+        scene.emitAll(head);
+    } else {
+        exportInOrder(n, threads,
+            [&](ChunkedWriter& dst, size_t from, size_t to) {
+                SvgExporter part(dst);
+                scene.emitRange(part, from, to);
+                return true;
+            },
+            [&](const ChunkedWriter& part, bool) { part.appendTo(w); });
+    }
+    head.end();
+}
+
+inline void exportJson(const Scene& scene, std::ostream& out, unsigned threads = 1) {
+    ChunkedWriter w(&out);
+    JsonExporter head(w);
+    head.begin();
+    size_t n = scene.size();
+    threads = unsigned(std::max<size_t>(1, std::min<size_t>(threads, n / 1024)));
+    if (threads == 1) {
+        scene.emitAll(head);
+    } else {
+        bool any = false;
+        exportInOrder(n, threads,
+            [&](ChunkedWriter& dst, size_t from, size_t to) {
+                JsonExporter part(dst);
+                scene.emitRange(part, from, to);
+                return part.wroteAny();
+            },
+            [&](const ChunkedWriter& part, bool nonEmpty) {
+                if (!nonEmpty) return;
+                if (any) w.put(',');
+                part.appendTo(w);
+                any = true;
+            });
+    }
+    head.end();
+}
+
+// ====================== Raster throughput report ======================
+// Renders the whole scene once per quality mode and prints Mpixels/s of the viewport
+inline void reportRasterThroughput(const Scene& scene, int width, int height, std::ostream& out = std::cout) {
+    const RasterQuality modes[] = { RasterQuality::Hard, RasterQuality::Supersample4x4, RasterQuality::Analytic };
+    Bounds view = scene.bounds();
+    for (RasterQuality q : modes) {
+        Raster raster(width, height, view);
+        raster.setQuality(q);
+        auto start = std::chrono::steady_clock::now();
+        scene.emitAll(raster);
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        out << qualityName(q) << ": " << double(width) * height / 1e6 / std::max(sec, 1e-9) << " Mpixels/s\n";
+    }
+}
+
+// ====================== Traversal cache-miss report ======================
+// Counts hardware cache misses of the calling thread through perf_event; available() is false
+// on other systems or when the kernel does not allow it (perf_event_paranoid, containers).
+class CacheMissCounter {
+    int fd = -1;
+public:
+    CacheMissCounter() {
+#ifdef __linux__
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~CacheMissCounter() {
+#ifdef __linux__
+        if (fd >= 0) close(fd);
+#endif
+    }
+    CacheMissCounter(const CacheMissCounter&) = delete;
+    CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+    bool available() const { return fd >= 0; }
+    void start() {
+#ifdef __linux__
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+    uint64_t stop() {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (fd < 0) return 0;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != ssize_t(sizeof(count))) count = 0;
+#endif
+        return count;
+    }
+};
+
+// Runs the bounds reduction over a cold scene (caches flushed by a large buffer first) without
+// prefetching and with the given distances, printing time and cache misses of each run
+inline void reportPrefetchEffect(const Scene& scene, const std::vector<size_t>& distances = {4, 8, 16},
+                                 std::ostream& out = std::cout) {
+    std::vector<char> flush(size_t(64) << 20);
+    CacheMissCounter misses;
+    size_t saved = prefetchDistance;
+    std::vector<size_t> runs(1, 0);
+    runs.insert(runs.end(), distances.begin(), distances.end());
+    for (size_t d : runs) {
+        for (size_t i = 0; i < flush.size(); i += 64) flush[i] = char(flush[i] + 1);
+        prefetchDistance = d;
+        misses.start();
+        auto start = std::chrono::steady_clock::now();
+        Bounds b = scene.bounds();
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uint64_t count = misses.stop();
+        out << "prefetch distance " << d << ": " << sec * 1e3 << " ms";
+        if (misses.available()) out << ", " << count << " cache misses";
+        out << (b.empty() ? " (empty scene)" : "") << "\n";
+    }
+    prefetchDistance = saved;
+}
+
+// ====================== Spatial hash ======================
+// Uniform grid hashed by cell coordinates; an object id is stored in every cell its bounds overlap.
+// Objects can be moved and removed in O(cells touched); cells are split into shards by key so
+// that a batch of moves updates them from several threads.
+class SpatialHash {
+    static constexpr size_t kMaxCellsPerObject = 64;
+    static constexpr size_t kShards = 64;
+    static constexpr double kCellLimit = 1e12;     // cell coordinates saturate here, far from int64 overflow
+    struct CellRange {
+        int64_t x0 = 0, y0 = 0, x1 = -1, y1 = -1;
+        bool oversized = false;
+        bool gridded() const { return x0 <= x1 && !oversized; }
+        bool contains(int64_t cx, int64_t cy) const { return gridded() && cx >= x0 && cx <= x1 && cy >= y0 && cy <= y1; }
+        bool operator==(const CellRange& o) const {
+            return x0 == o.x0 && y0 == o.y0 && x1 == o.x1 && y1 == o.y1 && oversized == o.oversized;
+        }
+    };
+    using Cells = std::unordered_map<uint64_t, std::vector<size_t>>;
+    double cell;
+    std::vector<Cells> shards;
+    std::vector<Bounds> boxes;          // by id
+    std::vector<uint8_t> alive;
+    std::vector<size_t> freeIds;
+    std::vector<size_t> oversized;      // too large for the grid, checked by every query
+    size_t live = 0;
+
+    // Far-away coordinates share the border cells; bounds are still compared exactly
+    int64_t cellOf(double v) const {
+        double c = std::floor(v / cell);
+        return c >= kCellLimit ? int64_t(kCellLimit) : c <= -kCellLimit ? -int64_t(kCellLimit) : c == c ? int64_t(c) : 0;
+    }
+    // In double: the span can exceed size_t
+    static double cellArea(int64_t x0, int64_t y0, int64_t x1, int64_t y1) {
+        return (double(x1 - x0) + 1) * (double(y1 - y0) + 1);
+    }
+    static uint64_t key(int64_t cx, int64_t cy) { return (uint64_t(cx) << 32) ^ (uint64_t(cy) & 0xffffffffu); }
+    static size_t shardOf(uint64_t k) { return size_t((k * 0x9E3779B97F4A7C15ull) >> 58); }
+    CellRange rangeOf(const Bounds& b) const {
+        CellRange r;
+        if (b.empty()) return r;
+        r.x0 = cellOf(b.minX); r.y0 = cellOf(b.minY); r.x1 = cellOf(b.maxX); r.y1 = cellOf(b.maxY);
+        r.oversized = cellArea(r.x0, r.y0, r.x1, r.y1) > double(kMaxCellsPerObject);
+        return r;
+    }
+    void addToCell(uint64_t k, size_t id) { shards[shardOf(k)][k].push_back(id); }
+    void removeFromCell(uint64_t k, size_t id) {
+        Cells& cells = shards[shardOf(k)];
+        auto it = cells.find(k);
+        if (it == cells.end()) return;
+        std::vector<size_t>& ids = it->second;
+        auto pos = std::find(ids.begin(), ids.end(), id);
+        if (pos != ids.end()) { *pos = ids.back(); ids.pop_back(); }
+        if (ids.empty()) cells.erase(it);
+    }
+    void link(size_t id, const CellRange& r) {
+        if (r.oversized) { oversized.push_back(id); return; }
+        for (int64_t cy = r.y0; cy <= r.y1; ++cy)
+            for (int64_t cx = r.x0; cx <= r.x1; ++cx) addToCell(key(cx, cy), id);
+    }
+    void unlink(size_t id, const CellRange& r) {
+        if (r.oversized) {
+            auto pos = std::find(oversized.begin(), oversized.end(), id);
+            if (pos != oversized.end()) { *pos = oversized.back(); oversized.pop_back(); }
+            return;
+        }
+        for (int64_t cy = r.y0; cy <= r.y1; ++cy)
+            for (int64_t cx = r.x0; cx <= r.x1; ++cx) removeFromCell(key(cx, cy), id);
+    }
+public:
+    explicit SpatialHash(double cellSize) : cell(cellSize > 0 ? cellSize : 1.0), shards(kShards) {}
+    double cellSize() const { return cell; }
+    // Ids handed out so far, removed ones included; liveCount() counts the stored objects
+    size_t size() const { return boxes.size(); }
+    size_t liveCount() const { return live; }
+    bool contains(size_t id) const { return id < alive.size() && alive[id]; }
+    const Bounds& boundsOf(size_t id) const { return boxes[id]; }
+
+    // Ids are sequential until something is removed; removed ids are reused
+    size_t insert(const Bounds& b) {
+        size_t id;
+        if (freeIds.empty()) { id = boxes.size(); boxes.push_back(b); alive.push_back(1); }
+        else { id = freeIds.back(); freeIds.pop_back(); boxes[id] = b; alive[id] = 1; }
+        ++live;
+        link(id, rangeOf(b));
+        return id;
+    }
+    void remove(size_t id) {
+        if (!contains(id)) return;
+        unlink(id, rangeOf(boxes[id]));
+        boxes[id] = Bounds();
+        alive[id] = 0;
+        freeIds.push_back(id);
+        --live;
+    }
+    // Only cells the object leaves or enters are touched; a move inside the same cells just
+    // overwrites the stored bounds
+    void move(size_t id, const Bounds& b) {
+        if (!contains(id)) return;
+        CellRange from = rangeOf(boxes[id]), to = rangeOf(b);
+        boxes[id] = b;
+        if (from == to) return;
+        if (from.oversized || to.oversized) { unlink(id, from); link(id, to); return; }
+        for (int64_t cy = from.y0; cy <= from.y1; ++cy)
+            for (int64_t cx = from.x0; cx <= from.x1; ++cx)
+                if (!to.contains(cx, cy)) removeFromCell(key(cx, cy), id);
+        for (int64_t cy = to.y0; cy <= to.y1; ++cy)
+            for (int64_t cx = to.x0; cx <= to.x1; ++cx)
+                if (!from.contains(cx, cy)) addToCell(key(cx, cy), id);
+    }
+
+    struct Move { size_t id; Bounds bounds; };
+    // Applies a batch of moves (each id at most once): threads compute the cell changes of their
+    // part of the batch, then every thread applies the changes of its own shards.
+    void update(const std::vector<Move>& moves, unsigned threads = std::thread::hardware_concurrency()) {
+        size_t workers = std::max<size_t>(1, std::min<size_t>(threads, moves.size() / 4096));
+        if (workers == 1) {
+            for (const Move& m : moves) move(m.id, m.bounds);
+            return;
+        }
+        struct Edit { uint64_t key; size_t id; bool add; };
+        std::vector<std::vector<std::vector<Edit>>> edits(workers, std::vector<std::vector<Edit>>(kShards));
+        std::vector<std::vector<std::pair<size_t, CellRange>>> regrid(workers);   // to or from oversized
+        parallelFor(workers, [&](size_t w) {
+            for (size_t i = moves.size() * w / workers; i < moves.size() * (w + 1) / workers; ++i) {
+                const Move& m = moves[i];
+                if (!contains(m.id)) continue;
+                CellRange from = rangeOf(boxes[m.id]), to = rangeOf(m.bounds);
+                boxes[m.id] = m.bounds;
+                if (from == to) continue;
+                if (from.oversized || to.oversized) {
+                    regrid[w].push_back({m.id, from});
+                    continue;
+                }
+                for (int64_t cy = from.y0; cy <= from.y1; ++cy)
+                    for (int64_t cx = from.x0; cx <= from.x1; ++cx)
+                        if (!to.contains(cx, cy)) { uint64_t k = key(cx, cy); edits[w][shardOf(k)].push_back({k, m.id, false}); }
+                for (int64_t cy = to.y0; cy <= to.y1; ++cy)
+                    for (int64_t cx = to.x0; cx <= to.x1; ++cx)
+                        if (!from.contains(cx, cy)) { uint64_t k = key(cx, cy); edits[w][shardOf(k)].push_back({k, m.id, true}); }
+            }
+        });
+        parallelFor(workers, [&](size_t w) {
+            for (size_t sh = w; sh < kShards; sh += workers)
+                for (size_t from = 0; from < workers; ++from)
+                    for (const Edit& e : edits[from][sh]) {
+                        if (e.add) addToCell(e.key, e.id);
+                        else removeFromCell(e.key, e.id);
+                    }
+        });
+        for (const auto& list : regrid)
+            for (const auto& r : list) { unlink(r.first, r.second); link(r.first, rangeOf(boxes[r.first])); }
+    }
+
+    // Calls visit(id) once for every object whose bounds intersect region. Safe to call from
+    // several threads: duplicates are dropped by reporting an object only from the cell
+    // holding the min corner of its overlap with the region.
+    template <typename Visit>
+    void query(const Bounds& region, Visit&& visit) const {
+        if (region.empty()) return;
+        for (size_t id : oversized)
+            if (boxes[id].intersects(region)) visit(id);
+        int64_t x0 = cellOf(region.minX), x1 = cellOf(region.maxX), y0 = cellOf(region.minY), y1 = cellOf(region.maxY);
+        size_t cellCount = 0;
+        for (const Cells& c : shards) cellCount += c.size();
+        if (cellArea(x0, y0, x1, y1) > double(cellCount)) {
+            for (const Cells& cells : shards)
+                for (const auto& c : cells) visitCell(c.first, c.second, region, visit);
+            return;
+        }
+        for (int64_t cy = y0; cy <= y1; ++cy)
+            for (int64_t cx = x0; cx <= x1; ++cx) {
+                uint64_t k = key(cx, cy);
+                const Cells& cells = shards[shardOf(k)];
+                auto it = cells.find(k);
+                if (it != cells.end()) visitCell(it->first, it->second, region, visit);
+            }
+    }
+    // Objects other than id within distance radius of its bounds (measured box to box)
+    template <typename Visit>
+    void neighbours(size_t id, double radius, Visit&& visit) const {
+        if (!contains(id)) return;
+        const Bounds& b = boxes[id];
+        query(Bounds(b.minX - radius, b.minY - radius, b.maxX + radius, b.maxY + radius),
+              [&](size_t other) { if (other != id) visit(other); });
+    }
+private:
+    template <typename Visit>
+    void visitCell(uint64_t k, const std::vector<size_t>& ids, const Bounds& region, Visit& visit) const {
+        for (size_t id : ids) {
+            const Bounds& b = boxes[id];
+            if (!b.intersects(region)) continue;
+            if (key(cellOf(std::max(b.minX, region.minX)), cellOf(std::max(b.minY, region.minY))) == k) visit(id);
+        }
+    }
+};
+
+// Moves the given fraction of n random boxes by up to one cell each tick and compares the
+// incremental batch update with rebuilding the hash from scratch
+inline void reportSpatialHashUpdate(size_t n, const std::vector<double>& motionRates = {0.01, 0.1, 0.5, 1.0},
+                                    std::ostream& out = std::cout) {
+    const double side = 1000, cellSize = side / std::max(1.0, std::sqrt(double(n)));
+    uint64_t seed = 88172645463325252ull;
+    auto rnd = [&] { seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17; return double(seed >> 11) / double(1ull << 53); };
+    std::vector<Bounds> boxes(n);
+    for (auto& b : boxes) {
+        double x = rnd() * side, y = rnd() * side;
+        b = Bounds(x, y, x + cellSize * 0.5, y + cellSize * 0.5);
+    }
+    for (double rate : motionRates) {
+        SpatialHash hash(cellSize);
+        for (const auto& b : boxes) hash.insert(b);
+        std::vector<SpatialHash::Move> moves;
+        size_t step = std::max<size_t>(1, size_t(1.0 / std::max(rate, 1e-9)));
+        for (size_t id = 0; id < n; id += step) {
+            Bounds b = boxes[id];
+            double dx = (rnd() - 0.5) * cellSize, dy = (rnd() - 0.5) * cellSize;
+            moves.push_back({id, Bounds(b.minX + dx, b.minY + dy, b.maxX + dx, b.maxY + dy)});
+        }
+        auto start = std::chrono::steady_clock::now();
+        hash.update(moves);
+        double incremental = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        SpatialHash rebuilt(cellSize);
+        for (size_t id = 0; id < n; ++id) rebuilt.insert(hash.boundsOf(id));
+        double rebuild = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        out << "moving " << rate * 100 << "% of " << n << ": update " << incremental * 1e3
+            << " ms, rebuild " << rebuild * 1e3 << " ms\n";
+    }
+}
+
+// ====================== Overlap grouping (connected components) ======================
+// Lock-free union-find: roots are linked with CAS (larger id under smaller), finds halve paths
+class ConcurrentUnionFind {
+    std::vector<std::atomic<uint32_t>> parent;
+public:
+    explicit ConcurrentUnionFind(size_t n = 0) { grow(n); }
+    size_t size() const { return parent.size(); }
+    // Not concurrent: call only while no other thread uses the structure
+    void grow(size_t n) {
+        if (n <= parent.size()) return;
+        std::vector<std::atomic<uint32_t>> next(n);
+        for (size_t i = 0; i < n; ++i)
+            next[i].store(i < parent.size() ? parent[i].load(std::memory_order_relaxed) : uint32_t(i), std::memory_order_relaxed);
+        parent.swap(next);
+    }
+    uint32_t find(uint32_t x) {
+        for (;;) {
+            uint32_t p = parent[x].load(std::memory_order_relaxed);
+            if (p == x) return x;
+            uint32_t gp = parent[p].load(std::memory_order_relaxed);
+            if (p != gp) parent[x].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+            x = gp;
+        }
+    }
+    void unite(uint32_t a, uint32_t b) {
+        for (;;) {
+            a = find(a); b = find(b);
+            if (a == b) return;
+            if (a < b) std::swap(a, b);
+            uint32_t expected = a;
+            if (parent[a].compare_exchange_strong(expected, b, std::memory_order_acq_rel)) return;
+        }
+    }
+};
+
+// Overlap pairs come from the spatial hash (broad phase: bounds intersection) and, in build(),
+// an optional exact test touches(a, b) on each candidate pair. build() runs the queries and
+// unions in parallel; add() keeps the components up to date one object at a time, by bounds only.
+class OverlapGrouper {
+    SpatialHash index;
+    ConcurrentUnionFind sets;
+public:
+    explicit OverlapGrouper(double cellSize) : index(cellSize) {}
+    size_t size() const { return index.size(); }
+
+    void build(const std::vector<Bounds>& boxes, unsigned threads = std::thread::hardware_concurrency()) {
+        build(boxes, threads, [](size_t, size_t) { return true; });
+    }
+    template <typename Touches>
+    void build(const std::vector<Bounds>& boxes, unsigned threads, Touches touches) {
+        size_t first = index.size();
+        for (const auto& b : boxes) index.insert(b);
+        sets.grow(index.size());
+        size_t n = index.size() - first;
+        threads = unsigned(std::max<size_t>(1, std::min<size_t>(threads, n / 1024)));
+        std::atomic<size_t> next(first);
+        parallelFor(threads, [&](size_t) {
+            for (size_t i; (i = next.fetch_add(256)) < index.size(); )
+                for (size_t id = i; id < std::min(i + 256, index.size()); ++id)
+                    index.query(index.boundsOf(id), [&](size_t other) {
+                        if ((other < id || other >= first) && touches(id, other)) sets.unite(uint32_t(id), uint32_t(other));
+                    });
+        });
+    }
+    size_t add(const Bounds& b) {
+        size_t id = index.insert(b);
+        if (sets.size() <= id) sets.grow(std::max<size_t>(16, 2 * (id + 1)));
+        index.query(b, [&](size_t other) { if (other != id) sets.unite(uint32_t(id), uint32_t(other)); });
+        return id;
+    }
+    uint32_t component(size_t id) { return sets.find(uint32_t(id)); }
+    std::vector<uint32_t> labels() {
+        std::vector<uint32_t> out(index.size());
+        for (size_t i = 0; i < out.size(); ++i) out[i] = sets.find(uint32_t(i));
+        return out;
+    }
+};
+
+inline void Scene::groupOverlapping(unsigned threads) {
+    if (objects.size() < 2) return;
+    std::vector<Bounds> boxes;
+    boxes.reserve(objects.size());
+    double extent = 0;
+    for (const auto* obj : objects) {
+        boxes.push_back(obj->bounds());
+        if (!boxes.back().empty()) extent += std::max(boxes.back().maxX - boxes.back().minX, boxes.back().maxY - boxes.back().minY);
+    }
+    // Narrow phase: circles (filled or not) are tested as discs, everything else by its bounds
+    struct Disc { double x, y, r; bool valid; };
+    std::vector<Disc> discs(objects.size(), Disc{0, 0, 0, false});
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const GraphObject* g = objects[i];
+        while (g->decorated()) g = g->decorated();
+        if (g->kind() != ShapeKind::Circle) continue;
+        const Circle* c = static_cast<const Circle*>(g);
+        discs[i] = Disc{c->getCenterX(), c->getCenterY(), c->getRadius(), true};
+    }
+    auto discTouchesBox = [](const Disc& d, const Bounds& b) {
+        double dx = d.x - std::max(b.minX, std::min(d.x, b.maxX)), dy = d.y - std::max(b.minY, std::min(d.y, b.maxY));
+        return dx * dx + dy * dy <= d.r * d.r;
+    };
+    auto touches = [&](size_t a, size_t b) {
+        const Disc& da = discs[a];
+        const Disc& db = discs[b];
+        if (da.valid && db.valid) {
+            double dx = da.x - db.x, dy = da.y - db.y, r = da.r + db.r;
+            return dx * dx + dy * dy <= r * r;
+        }
+        if (da.valid) return discTouchesBox(da, boxes[b]);
+        if (db.valid) return discTouchesBox(db, boxes[a]);
+        return true;
+    };
+    OverlapGrouper grouper(extent > 0 ? 2 * extent / objects.size() : 1.0);
+    grouper.build(boxes, threads, touches);
+    std::vector<uint32_t> label = grouper.labels();
+
+    std::vector<uint32_t> members(objects.size(), 0);
+    for (uint32_t root : label) ++members[root];
+    std::vector<Composite*> group(objects.size(), nullptr);
+    std::vector<GraphObject*> regrouped;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        uint32_t root = label[i];
+        if (members[root] == 1) { regrouped.push_back(objects[i]); continue; }
+        if (!group[root]) { group[root] = new Composite(true); regrouped.push_back(group[root]); }
+    }
+    // Members go in draw order, and the group draws with the key of its topmost member
+    std::vector<uint32_t> byDepth(objects.size());
+    std::iota(byDepth.begin(), byDepth.end(), 0u);
+    std::stable_sort(byDepth.begin(), byDepth.end(),
+                     [&](uint32_t a, uint32_t b) { return objects[a]->sortKey() < objects[b]->sortKey(); });
+    for (uint32_t i : byDepth) {
+        Composite* g = group[label[i]];
+        if (!g) continue;
+        g->add(objects[i]);
+        g->setDepth(objects[i]->getLayer(), objects[i]->getZIndex());
+    }
+    objects.swap(regrouped);
+    invalidateOrder();
+    recountStats();
+}
+
+// ====================== Tile pyramid export ======================
+// Level z splits the (square) scene extent into 2^z x 2^z tiles, each written as
+// dir/z/x/y.pgm. Existing tiles are kept, so an interrupted export can be resumed.
+struct TilePyramidStats {
+    size_t written = 0, resumed = 0, empty = 0, failed = 0;
+};
+
+class TilePyramidExporter {
+    const Scene& scene;
+    int tileSize;
+    double lodPixels;       // objects smaller than this on screen become a single dot
+    Bounds world;
+    std::unique_ptr<SpatialHash> index;
+
+    Bounds tileBounds(int z, int64_t tx, int64_t ty) const {
+        double size = (world.maxX - world.minX) / double(int64_t(1) << z);
+        return Bounds(world.minX + tx * size, world.minY + ty * size,
+                      world.minX + (tx + 1) * size, world.minY + (ty + 1) * size);
+    }
+    static bool writePgm(const std::filesystem::path& file, const Raster& r) {
+        std::filesystem::path tmp = file;
+        tmp += ".part";
+        {
+            std::ofstream out(tmp, std::ios::binary);
+            out << "P5\n" << r.width() << " " << r.height() << "\n255\n";
+            out.write(reinterpret_cast<const char*>(r.data().data()), std::streamsize(r.data().size()));
+            if (!out) return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, file, ec);
+        return !ec;
+    }
+public:
+    TilePyramidExporter(const Scene& s, int tilePixels = 256, double lodPx = 1.0)
+        : scene(s), tileSize(std::max(tilePixels, 1)), lodPixels(lodPx) {}
+
+    // Builds the spatial index once; called by exportTo if needed
+    void buildIndex() {
+        world = scene.bounds();
+        if (world.empty()) world = Bounds(0, 0, 1, 1);
+        double side = std::max({world.maxX - world.minX, world.maxY - world.minY, 1e-9});
+        world = Bounds(world.minX, world.minY, world.minX + side, world.minY + side);
+        index.reset(new SpatialHash(side / std::max<size_t>(1, size_t(std::sqrt(double(scene.size()))))));
+        for (size_t i = 0; i < scene.size(); ++i) index->insert(scene.at(i)->bounds());
+    }
+
+    TilePyramidStats exportTo(const std::string& dir, int levels, unsigned threads = std::thread::hardware_concurrency()) {
+        if (!index) buildIndex();
+        threads = std::max(1u, threads);
+        std::atomic<size_t> written(0), resumed(0), empty(0), failed(0);
+        std::vector<char> parentHit(1, 1);      // tiles of level z-1 that had content
+
+        for (int z = 0; z < levels; ++z) {
+            int64_t n = int64_t(1) << z;
+            std::vector<char> hit(size_t(n * n), 0);
+            std::atomic<int64_t> next(0);
+            double pixelWorld = (world.maxX - world.minX) / double(n) / tileSize;
+
+            auto work = [&] {
+                std::vector<size_t> ids;
+                for (int64_t t; (t = next++) < n * n; ) {
+                    int64_t tx = t % n, ty = t / n;
+                    if (z > 0 && !parentHit[size_t((ty / 2) * (n / 2) + tx / 2)]) { ++empty; continue; }
+                    Bounds region = tileBounds(z, tx, ty);
+                    ids.clear();
+                    index->query(region, [&](size_t id) { ids.push_back(id); });
+                    if (ids.empty()) { ++empty; continue; }
+                    hit[size_t(t)] = 1;
+
+                    std::filesystem::path file = std::filesystem::path(dir) / std::to_string(z) / std::to_string(tx);
+                    std::error_code ec;     // worker threads must not throw
+                    std::filesystem::create_directories(file, ec);
+                    if (ec) { ++failed; continue; }
+                    file /= std::to_string(ty) + ".pgm";
+                    bool present = std::filesystem::exists(file, ec);
+                    if (ec) { ++failed; continue; }
+                    if (present) { ++resumed; continue; }
+
+                    std::sort(ids.begin(), ids.end());      // keep scene draw order
+                    Raster raster(tileSize, tileSize, region);
+                    LodSink lod(raster);
+                    for (size_t id : ids) {
+                        const Bounds& b = index->boundsOf(id);
+                        bool tiny = std::max(b.maxX - b.minX, b.maxY - b.minY) < lodPixels * pixelWorld;
+                        if (tiny) scene.at(id)->emit(lod);
+                        else scene.at(id)->emit(raster);
+                    }
+                    if (writePgm(file, raster)) ++written;
+                    else ++failed;
+                }
+            };
+            parallelFor(threads, [&](size_t) { work(); });
+            parentHit.swap(hit);
+        }
+        TilePyramidStats stats;
+        stats.written = written; stats.resumed = resumed; stats.empty = empty;
+        stats.failed = failed;
+        return stats;
+    }
+};
+
+// ====================== Terminal preview ======================
+// Rasterizes the scene into a character grid: braille cells hold 2x4 dots, block cells 1x2
+class TerminalPreview {
+public:
+    enum class Glyphs { Braille, Blocks };
+private:
+    int cols, rows;
+    Glyphs glyphs;
+
+    static void putUtf8(std::string& out, unsigned cp) {
+        if (cp < 0x80) { out += char(cp); return; }
+        if (cp < 0x800) { out += char(0xC0 | (cp >> 6)); out += char(0x80 | (cp & 0x3F)); return; }
+        out += char(0xE0 | (cp >> 12)); out += char(0x80 | ((cp >> 6) & 0x3F)); out += char(0x80 | (cp & 0x3F));
+    }
+public:
+    explicit TerminalPreview(Glyphs g = Glyphs::Braille, int columns = 0, int lines = 0) : glyphs(g) {
+        if (columns <= 0 || lines <= 0) terminalSize(columns, lines);
+        cols = std::max(columns, 1);
+        rows = std::max(lines - 1, 1);      // keep the prompt line
+    }
+    static void terminalSize(int& columns, int& lines) {
+        columns = 80; lines = 24;
+#ifdef __unix__
+        winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0) {
+            columns = ws.ws_col; lines = ws.ws_row;
+            return;
+        }
+#endif
+        if (const char* c = std::getenv("COLUMNS")) columns = std::max(1, std::atoi(c));
+        if (const char* l = std::getenv("LINES")) lines = std::max(1, std::atoi(l));
+    }
+
+    // Uses the same viewport culling, occlusion and LOD path as the raster renderer
+    std::string render(const Scene& scene, FrameStats* stats = nullptr) const {
+        int cw = glyphs == Glyphs::Braille ? 2 : 1, ch = glyphs == Glyphs::Braille ? 4 : 2;
+        Bounds view = scene.bounds();
+        if (view.empty()) view = Bounds(0, 0, 1, 1);
+        Raster raster(cols * cw, rows * ch, view);
+        FrameStats local;
+        scene.renderFrontToBack(raster, stats ? *stats : local, 1.0);
+
+        static const unsigned brailleBit[4][2] = { {0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80} };
+        std::string out;
+        out.reserve(size_t(rows) * (cols * 3 + 1));
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                if (glyphs == Glyphs::Braille) {
+                    unsigned bits = 0;
+                    for (int dy = 0; dy < 4; ++dy)
+                        for (int dx = 0; dx < 2; ++dx)
+                            if (raster.at(c * 2 + dx, r * 4 + dy)) bits |= brailleBit[dy][dx];
+                    putUtf8(out, bits ? 0x2800 + bits : ' ');
+                } else {
+                    bool top = raster.at(c, r * 2) != 0, bottom = raster.at(c, r * 2 + 1) != 0;
+                    putUtf8(out, top && bottom ? 0x2588 : top ? 0x2580 : bottom ? 0x2584 : ' ');
+                }
+            }
+            out += '\n';
+        }
+        return out;
+    }
+    void print(const Scene& scene, std::ostream& out = std::cout) const { out << render(scene); }
+};
+
+// ====================== Convex hull and simplification ======================
+// Collects the vertices of everything emitted; circles contribute 16 points on their boundary
+class VertexCollector : public ShapeSink {
+    std::vector<double>& out;
+    void add(double x, double y) { out.push_back(x); out.push_back(y); }
+public:
+    explicit VertexCollector(std::vector<double>& xy) : out(xy) {}
+    void point(double x, double y, bool) override { add(x, y); }
+    void line(double x1, double y1, double x2, double y2, bool) override { add(x1, y1); add(x2, y2); }
+    void circle(double cx, double cy, double r, bool) override {
+        const double step = 3.14159265358979323846 / 8;
+        for (int k = 0; k < 16; ++k) add(cx + r * std::cos(k * step), cy + r * std::sin(k * step));
+    }
+    void triangle(const double* v, bool) override { out.insert(out.end(), v, v + 6); }
+    void polyline(const double* xy, size_t n, bool, bool) override { out.insert(out.end(), xy, xy + 2 * n); }
+};
+
+inline std::vector<double> collectVertices(const GraphObject& g) {
+    std::vector<double> xy;
+    VertexCollector sink(xy);
+    g.emit(sink);
+    return xy;
+}
+
+inline std::vector<double> collectVertices(const Scene& scene, unsigned threads = std::thread::hardware_concurrency()) {
+    size_t n = scene.size();
+    threads = unsigned(std::max<size_t>(1, std::min<size_t>(threads, n / 4096)));
+    std::vector<std::vector<double>> parts(threads);
+    parallelFor(threads, [&](size_t t) { VertexCollector sink(parts[t]); scene.emitRange(sink, n * t / threads, n * (t + 1) / threads); });
+    std::vector<double> xy;
+    size_t total = 0;
+    for (const auto& p : parts) total += p.size();
+    xy.reserve(total);
+    for (const auto& p : parts) xy.insert(xy.end(), p.begin(), p.end());
+    return xy;
+}
+
+namespace hull_detail {
+struct Pt { double x, y; };
+inline bool operator<(const Pt& a, const Pt& b) { return a.x < b.x || (a.x == b.x && a.y < b.y); }
+inline double cross(const Pt& o, const Pt& a, const Pt& b) { return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x); }
+
+// Andrew's monotone chain, counter-clockwise, collinear points dropped
+inline std::vector<Pt> monotoneChain(std::vector<Pt> p) {
+    std::sort(p.begin(), p.end());
+    p.erase(std::unique(p.begin(), p.end(), [](const Pt& a, const Pt& b) { return a.x == b.x && a.y == b.y; }), p.end());
+    if (p.size() < 3) return p;
+    std::vector<Pt> h(2 * p.size());
+    size_t k = 0;
+    for (size_t i = 0; i < p.size(); ++i) {
+        while (k >= 2 && cross(h[k - 2], h[k - 1], p[i]) <= 0) --k;
+        h[k++] = p[i];
+    }
+    for (size_t i = p.size() - 1, lower = k + 1; i-- > 0; ) {
+        while (k >= lower && cross(h[k - 2], h[k - 1], p[i]) <= 0) --k;
+        h[k++] = p[i];
+    }
+    h.resize(k - 1);
+    return h;
+}
+
+// Akl-Toussaint: drop points strictly inside the octagon of extreme points, then run the chain
+inline std::vector<Pt> chunkHull(const double* xy, size_t n) {
+    if (!n) return {};
+    Pt ext[8];
+    for (auto& e : ext) e = Pt{xy[0], xy[1]};
+    for (size_t i = 1; i < n; ++i) {
+        double x = xy[2 * i], y = xy[2 * i + 1];
+        if (x < ext[0].x) ext[0] = Pt{x, y};
+        if (x + y < ext[1].x + ext[1].y) ext[1] = Pt{x, y};
+        if (y < ext[2].y) ext[2] = Pt{x, y};
+        if (x - y > ext[3].x - ext[3].y) ext[3] = Pt{x, y};
+        if (x > ext[4].x) ext[4] = Pt{x, y};
+        if (x + y > ext[5].x + ext[5].y) ext[5] = Pt{x, y};
+        if (y > ext[6].y) ext[6] = Pt{x, y};
+        if (y - x > ext[7].y - ext[7].x) ext[7] = Pt{x, y};
+    }
+    std::vector<Pt> octagon = monotoneChain(std::vector<Pt>(ext, ext + 8));
+    std::vector<Pt> keep;
+    for (size_t i = 0; i < n; ++i) {
+        Pt q{xy[2 * i], xy[2 * i + 1]};
+        bool inside = octagon.size() >= 3;
+        for (size_t j = 0; j < octagon.size() && inside; ++j)
+            inside = cross(octagon[j], octagon[(j + 1) % octagon.size()], q) > 0;
+        if (!inside) keep.push_back(q);
+    }
+    return monotoneChain(std::move(keep));
+}
+}
+
+// Convex hull of n points (x,y pairs) as counter-clockwise x,y pairs. Each thread takes a
+// contiguous chunk, filters it and builds its hull; the chunk hulls are then merged.
+inline std::vector<double> convexHull(const double* xy, size_t n, unsigned threads = std::thread::hardware_concurrency()) {
+    using namespace hull_detail;
+    threads = unsigned(std::max<size_t>(1, std::min<size_t>(threads, n / 65536)));
+    std::vector<std::vector<Pt>> parts(threads);
+    parallelFor(threads, [&](size_t t) {
+        size_t first = n * t / threads, last = n * (t + 1) / threads;
+        parts[t] = chunkHull(xy + 2 * first, last - first);
+    });
+    std::vector<Pt> merged;
+    for (const auto& p : parts) merged.insert(merged.end(), p.begin(), p.end());
+    std::vector<Pt> hull = threads > 1 ? monotoneChain(std::move(merged)) : std::move(merged);
+    std::vector<double> out;
+    out.reserve(hull.size() * 2);
+    for (const auto& p : hull) { out.push_back(p.x); out.push_back(p.y); }
+    return out;
+}
+
+inline Polygon* convexHullOf(const Scene& scene) {
+    std::vector<double> xy = collectVertices(scene);
+    return new Polygon(convexHull(xy.data(), xy.size() / 2), true);
+}
+
+inline Polygon* convexHullOf(const GraphObject& g) {
+    std::vector<double> xy = collectVertices(g);
+    return new Polygon(convexHull(xy.data(), xy.size() / 2), g.getColor());
+}
+
+// Grid snapping: one point per cell of size cell, snapped to the cell center, first-seen order kept
+inline std::vector<double> snapToGrid(const double* xy, size_t n, double cell) {
+    std::vector<double> out;
+    if (cell <= 0) return std::vector<double>(xy, xy + 2 * n);
+    std::unordered_map<uint64_t, char> seen;
+    seen.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        double fx = std::floor(xy[2 * i] / cell), fy = std::floor(xy[2 * i + 1] / cell);
+        if (!(std::fabs(fx) < 0x1p62 && std::fabs(fy) < 0x1p62)) {    // no int64 cell: kept as is
+            out.push_back(xy[2 * i]);
+            out.push_back(xy[2 * i + 1]);
+            continue;
+        }
+        int64_t cx = int64_t(fx), cy = int64_t(fy);
+        if (!seen.emplace(uint64_t(cx) * 0x9E3779B97F4A7C15ull ^ uint64_t(cy), 0).second) continue;
+        out.push_back((cx + 0.5) * cell);
+        out.push_back((cy + 0.5) * cell);
+    }
+    return out;
+}
+
+// Douglas-Peucker with an explicit stack; endpoints are always kept
+inline std::vector<double> douglasPeucker(const double* xy, size_t n, double eps) {
+    if (n < 3 || eps <= 0) return std::vector<double>(xy, xy + 2 * n);
+    std::vector<char> keep(n, 0);
+    keep[0] = keep[n - 1] = 1;
+    std::vector<std::pair<size_t, size_t>> stack{{0, n - 1}};
+    while (!stack.empty()) {
+        size_t a = stack.back().first, b = stack.back().second;
+        stack.pop_back();
+        double ax = xy[2 * a], ay = xy[2 * a + 1], dx = xy[2 * b] - ax, dy = xy[2 * b + 1] - ay;
+        double len = std::hypot(dx, dy);
+        double best = -1; size_t at = a;
+        for (size_t i = a + 1; i < b; ++i) {
+            double px = xy[2 * i] - ax, py = xy[2 * i + 1] - ay;
+            double d = len > 0 ? std::fabs(dx * py - dy * px) / len : std::hypot(px, py);
+            if (d > best) { best = d; at = i; }
+        }
+        if (best > eps) {
+            keep[at] = 1;
+            stack.push_back({a, at});
+            stack.push_back({at, b});
+        }
+    }
+    std::vector<double> out;
+    for (size_t i = 0; i < n; ++i)
+        if (keep[i]) { out.push_back(xy[2 * i]); out.push_back(xy[2 * i + 1]); }
+    return out;
+}
+
+inline void Polyline::simplify(double eps) {
+    if (vertexCount() < 3) return;     // nothing to drop; also covers an empty G
+    if (!closed) { xy = douglasPeucker(xy.data(), vertexCount(), eps); return; }
+    // Closed ring: run on the path with the first vertex repeated, then drop the copy
+    std::vector<double> ring(xy);
+    ring.push_back(xy[0]); ring.push_back(xy[1]);
+    std::vector<double> out = douglasPeucker(ring.data(), ring.size() / 2, eps);
+    if (out.size() >= 8) out.resize(out.size() - 2);
+    else out = xy;
+    xy.swap(out);
+}
+
+// ====================== Keyframe animation ======================
+struct Keyframe {
+    double time;
+    double x, y = 0;    // position offset from where the object started; radius and fill use x
+};
+
+// Keyframed tracks evaluated once per frame, updating objects in place. Tracks of one kind live
+// in flat arrays; each frame their segments are looked up, gathered into contiguous buffers and
+// interpolated in a branch-free loop (vectorized by GCC at -O3), and only objects whose value changed are
+// written and reported in dirty().
+class Animator {
+public:
+    enum class Channel { Position, Radius, Fill };
+private:
+    static constexpr size_t kBatch = 1024;
+    struct Tracks {
+        std::vector<GraphObject*> target;
+        std::vector<uint32_t> slot;                 // target's index in dirtyFlag
+        std::vector<uint32_t> first, count, cursor; // keyframes [first, first + count), current segment
+        std::vector<double> curX, curY;             // value last applied
+    };
+    Tracks tracks[3];
+    std::vector<double> keyT, keyX, keyY;
+    std::unordered_map<const GraphObject*, uint32_t> slots;
+    std::vector<GraphObject*> slotTarget;
+    std::vector<uint8_t> dirtyFlag;
+    std::vector<uint32_t> dirtySlots;
+    std::vector<GraphObject*> dirtyList;
+
+    void add(Channel ch, GraphObject* obj, const std::vector<Keyframe>& keys, double x0, double y0) {
+        if (!obj || keys.empty()) return;
+        std::vector<Keyframe> sorted(keys);
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Keyframe& a, const Keyframe& b) { return a.time < b.time; });
+        Tracks& t = tracks[int(ch)];
+        auto found = slots.emplace(obj, uint32_t(slots.size()));
+        if (found.second) { slotTarget.push_back(obj); dirtyFlag.push_back(0); }
+        t.target.push_back(obj);
+        t.slot.push_back(found.first->second);
+        t.first.push_back(uint32_t(keyT.size()));
+        t.count.push_back(uint32_t(sorted.size()));
+        t.cursor.push_back(0);
+        t.curX.push_back(x0);
+        t.curY.push_back(y0);
+        for (const Keyframe& k : sorted) { keyT.push_back(k.time); keyX.push_back(k.x); keyY.push_back(k.y); }
+    }
+    // Evaluates tracks [begin, end) of one channel at time, appending changed slots to changed
+    void evaluateBatch(Channel ch, double time, size_t begin, size_t end, std::vector<uint32_t>& changed) {
+        Tracks& t = tracks[int(ch)];
+        size_t n = end - begin;
+        double t0[kBatch], t1[kBatch], x0[kBatch], x1[kBatch], y0[kBatch], y1[kBatch], nx[kBatch], ny[kBatch];
+        for (size_t j = 0; j < n; ++j) {
+            size_t i = begin + j;
+            GRAPH_PREFETCH(t.target[i]);        // written in the last pass
+            const double* kt = &keyT[t.first[i]];
+            uint32_t last = t.count[i] - 1, c = std::min(t.cursor[i], last);
+            while (c > 0 && time < kt[c]) --c;
+            while (c < last && time >= kt[c + 1]) ++c;
+            t.cursor[i] = c;
+            uint32_t a = t.first[i] + c, b = t.first[i] + std::min(c + 1, last);
+            t0[j] = keyT[a]; t1[j] = keyT[b];
+            x0[j] = keyX[a]; x1[j] = keyX[b];
+            y0[j] = keyY[a]; y1[j] = keyY[b];
+        }
+        for (size_t j = 0; j < n; ++j) {
+            // A select around the divide is not if-converted (it may trap), so a zero span divides by
+            // the smallest double instead: its two keys then hold the same value, or u clamps to 0
+            double u = (time - t0[j]) / std::max(t1[j] - t0[j], std::numeric_limits<double>::min());
+            u = u < 0 ? 0 : (u > 1 ? 1 : u);
+            nx[j] = x0[j] + (x1[j] - x0[j]) * u;
+            ny[j] = y0[j] + (y1[j] - y0[j]) * u;
+        }
+        for (size_t j = 0; j < n; ++j) {
+            size_t i = begin + j;
+            double dx = nx[j] - t.curX[i], dy = ny[j] - t.curY[i];
+            if (ch == Channel::Fill) {
+                bool on = nx[j] >= 0.5;
+                if (on == (t.curX[i] >= 0.5)) continue;
+                static_cast<FilledDecorator*>(t.target[i])->setFilled(on);
+            } else if (dx == 0 && dy == 0) {
+                continue;
+            } else if (ch == Channel::Position) {
+                t.target[i]->translate(dx, dy);
+            } else {
+                static_cast<Circle*>(t.target[i])->setRadius(nx[j]);
+            }
+            t.curX[i] = nx[j];
+            t.curY[i] = ny[j];
+            changed.push_back(t.slot[i]);
+        }
+    }
+public:
+    // Position keys are offsets from the object's place when the track is added; works for
+    // any object, Composites included
+    void addPosition(GraphObject* obj, const std::vector<Keyframe>& keys) { add(Channel::Position, obj, keys, 0, 0); }
+    void addRadius(Circle* circle, const std::vector<Keyframe>& keys) {
+        if (circle) add(Channel::Radius, circle, keys, circle->getRadius(), 0);
+    }
+    // Filled while the interpolated key value is >= 0.5
+    void addFill(FilledDecorator* decorator, const std::vector<Keyframe>& keys) {
+        if (decorator) add(Channel::Fill, decorator, keys, decorator->isFilled() ? 1.0 : 0.0, 0);
+    }
+    size_t trackCount() const { return tracks[0].target.size() + tracks[1].target.size() + tracks[2].target.size(); }
+
+    // Moves every animated object to its state at time. Batches run on several threads, so the
+    // tracks of one channel must target distinct objects, none nested in another.
+    void evaluate(double time, unsigned threads = std::thread::hardware_concurrency()) {
+        dirtyList.clear();
+        dirtySlots.clear();
+        for (int c = 0; c < 3; ++c) {
+            size_t n = tracks[c].target.size();
+            size_t batches = (n + kBatch - 1) / kBatch;
+            size_t workers = std::max<size_t>(1, std::min<size_t>(threads, batches));
+            std::vector<std::vector<uint32_t>> changed(workers);
+            parallelFor(workers, [&, c](size_t w) {
+                for (size_t b = w * batches / workers; b < (w + 1) * batches / workers; ++b)
+                    evaluateBatch(Channel(c), time, b * kBatch, std::min(n, (b + 1) * kBatch), changed[w]);
+            });
+            for (const auto& list : changed)
+                for (uint32_t s : list)
+                    if (!dirtyFlag[s]) { dirtyFlag[s] = 1; dirtySlots.push_back(s); }
+        }
+        for (uint32_t s : dirtySlots) { dirtyFlag[s] = 0; dirtyList.push_back(slotTarget[s]); }
+        dirtySlots.clear();
+    }
+    // Objects changed by the last evaluate(), each once
+    const std::vector<GraphObject*>& dirty() const { return dirtyList; }
+};
+
+// ====================== Facade call trace: recording ======================
+enum class TraceKind : uint8_t { Build = 1, BuildLazy, Query, ExportSvg, ExportJson };
+
+// Compact binary log of facade calls: per call the kind, start time (zig-zag varint delta from the
+// previous call, microseconds), duration and input. Command strings seen before are written as
+// a back-reference, so a workload repeating the same scenes stays small. Strings are remembered
+// by 64-bit FNV-1a hash and length only, so the table does not grow with the input size.
+class TraceRecorder {
+    struct TextKey {
+        uint64_t hash, size;
+        bool operator==(const TextKey& o) const { return hash == o.hash && size == o.size; }
+    };
+    struct TextKeyHash {
+        size_t operator()(const TextKey& k) const { return size_t(k.hash ^ (k.size * 0x9E3779B97F4A7C15ull)); }
+    };
+    std::ostream& out;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    int64_t lastStart = 0;
+    std::unordered_map<TextKey, uint64_t, TextKeyHash> seen;
+    size_t callCount = 0;
+
+    static uint64_t fnv1a(const std::string& text) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (unsigned char c : text) { h ^= c; h *= 0x100000001b3ull; }
+        return h;
+    }
+
+    void varint(uint64_t v) {
+        char buf[10];
+        int n = 0;
+        do { buf[n++] = char((v & 0x7f) | (v > 0x7f ? 0x80 : 0)); v >>= 7; } while (v);
+        out.write(buf, n);
+    }
+    int64_t micros(std::chrono::steady_clock::time_point t) const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(t - origin).count();
+    }
+    void header(TraceKind kind, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+        int64_t at = micros(start), delta = at - lastStart;
+        lastStart = at;
+        out.put(char(kind));
+        varint((uint64_t(delta) << 1) ^ uint64_t(delta >> 63));
+        varint(uint64_t(std::max<int64_t>(0, micros(end) - at)));
+        ++callCount;
+    }
+public:
+    static constexpr char kMagic[8] = {'G', 'T', 'R', 'A', 'C', 'E', '1', '\n'};
+    explicit TraceRecorder(std::ostream& out) : out(out) { out.write(kMagic, sizeof(kMagic)); }
+    size_t calls() const { return callCount; }
+
+    void recordText(TraceKind kind, std::chrono::steady_clock::time_point start,
+                    std::chrono::steady_clock::time_point end, const std::string& text) {
+        std::lock_guard<std::mutex> lock(mutex);
+        header(kind, start, end);
+        TextKey key{fnv1a(text), text.size()};
+        auto found = seen.find(key);
+        if (found != seen.end()) { varint(found->second + 1); return; }
+        varint(0);
+        varint(text.size());
+        out.write(text.data(), std::streamsize(text.size()));
+        seen.emplace(key, seen.size());
+    }
+    void recordExport(TraceKind kind, std::chrono::steady_clock::time_point start,
+                      std::chrono::steady_clock::time_point end, unsigned threads) {
+        std::lock_guard<std::mutex> lock(mutex);
+        header(kind, start, end);
+        varint(threads);
+    }
+    void recordQuery(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end,
+                     const Bounds& region) {
+        std::lock_guard<std::mutex> lock(mutex);
+        header(TraceKind::Query, start, end);
+        const double v[4] = {region.minX, region.minY, region.maxX, region.maxY};
+        out.write(reinterpret_cast<const char*>(v), sizeof(v));
+    }
+    void flush() { std::lock_guard<std::mutex> lock(mutex); out.flush(); }
+};
+
+// ====================== Scene statistics self-check ======================
+// Random add / remove / modify / merge on a scene shard. The incremental statistics are compared
+// with the counts of what was put in, with a full recount, and lazy blocks must stay unbuilt.
+// Returns an empty string when everything matches, otherwise the first mismatch.
+inline std::string checkSceneStats(size_t steps = 3000, uint64_t seed = 88172645463325252ull) {
+    auto rnd = [&](uint64_t n) { seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17; return seed % n; };
+    struct Expected {
+        GraphObject* obj;
+        size_t byKind[kShapeKinds];
+        size_t shapes, filled, filledTriangles;
+        LazyCommandBlock* lazy;
+    };
+    auto make = [&]() {
+        Expected e{nullptr, {}, 0, 0, 0, nullptr};
+        double x = double(rnd(100)), y = double(rnd(100));
+        auto shape = [&](ShapeKind k, size_t n, bool filled) {
+            e.byKind[int(k)] += n; e.shapes += n;
+            if (filled) { e.filled += n; if (k == ShapeKind::Triangle) e.filledTriangles += n; }
+        };
+        switch (rnd(8)) {
+            case 0: e.obj = new Circle(x, y, double(rnd(40))); shape(ShapeKind::Circle, 1, false); break;
+            case 1: e.obj = new FilledDecorator(new TriangleAdapter(x, y, x + 5, y, x, y + 3)); shape(ShapeKind::Triangle, 1, true); break;
+            case 2: {
+                auto* group = new Composite();
+                group->add(new Point(x, y));
+                group->add(new FilledDecorator(new Circle(x, y, 2)));
+                e.obj = group;
+                ++e.byKind[int(ShapeKind::Composite)];
+                shape(ShapeKind::Point, 1, false); shape(ShapeKind::Circle, 1, true);
+                break;
+            }
+            case 3: e.obj = new Line(x, y, x + double(rnd(300)), y); shape(ShapeKind::Line, 1, false); break;
+            case 4: e.obj = new Polyline({x, y, x + 1, y + 1, x + 2, y}); shape(ShapeKind::Polyline, 1, false); break;
+            case 5: {
+                size_t n = 1 + rnd(50);
+                e.obj = cloneN(Circle(x, y, 1), n);
+                shape(ShapeKind::Circle, n, false);
+                break;
+            }
+            case 6: {
+                size_t n = 1 + rnd(10);
+                std::shared_ptr<double> data(new double[3 * n], std::default_delete<double[]>());
+                for (size_t i = 0; i < 3 * n; ++i) data.get()[i] = double(rnd(100));
+                e.obj = new BufferView<double>(data, n, BufferShape::Circles);
+                shape(ShapeKind::Circle, n, false);
+                break;
+            }
+            default:
+                e.lazy = LazyCommandBlock::index(std::make_shared<const std::string>("C 1,2,3; T 0,0,4,0,0,4; F; P 5,5"), true);
+                e.obj = e.lazy;
+                shape(ShapeKind::Circle, 1, false); shape(ShapeKind::Triangle, 1, true); shape(ShapeKind::Point, 1, false);
+                break;
+        }
+        return e;
+    };
+    std::unique_ptr<Scene> scene = Scene::createShard();
+    std::vector<Expected> live;
+    auto verify = [&](const char* where) -> std::string {
+        SceneStats st = scene->stats();
+        size_t byKind[kShapeKinds] = {}, shapes = 0, filled = 0, filledTriangles = 0;
+        Bounds b;
+        for (const Expected& e : live) {
+            for (int k = 0; k < kShapeKinds; ++k) byKind[k] += e.byKind[k];
+            shapes += e.shapes; filled += e.filled; filledTriangles += e.filledTriangles;
+            if (e.lazy && e.lazy->materializedCount() != 0) return std::string(where) + ": lazy block was built";
+            if (e.obj->cheapBounds()) b.expand(e.obj->bounds());
+        }
+        if (st.objects != live.size()) return std::string(where) + ": object count";
+        for (int k = 0; k < kShapeKinds; ++k)
+            if (st.byKind[k] != byKind[k]) return std::string(where) + ": count of kind " + std::to_string(k);
+        if (st.shapes != shapes || st.filledShapes != filled || st.filledTriangles != filledTriangles)
+            return std::string(where) + ": shape or fill counts";
+        if (st.bounds.empty() != b.empty() || (!b.empty() && (st.bounds.minX != b.minX || st.bounds.minY != b.minY ||
+                                                              st.bounds.maxX != b.maxX || st.bounds.maxY != b.maxY)))
+            return std::string(where) + ": bounds";
+        size_t memory = st.memory, histogram = 0;
+        for (size_t h : st.sizeHistogram) histogram += h;
+        if (histogram + st.unbounded != st.objects) return std::string(where) + ": size histogram";
+        scene->recountStats();
+        if (scene->stats().memory != memory) return std::string(where) + ": memory differs from a recount";
+        return "";
+    };
+    for (size_t step = 0; step < steps; ++step) {
+        size_t op = rnd(4);
+        if (op < 2 || live.empty()) {
+            live.push_back(make());
+            scene->addObject(live.back().obj);
+        } else if (op == 2) {
+            size_t i = rnd(live.size());
+            scene->removeObject(live[i].obj);
+            live.erase(live.begin() + std::ptrdiff_t(i));
+        } else {
+            size_t i = rnd(live.size());
+            scene->modify(live[i].obj, [&](GraphObject& g) {
+                g.translate(double(rnd(50)) - 25, 3);
+                g.setDepth(int(rnd(3)), 0);
+            });
+        }
+        if (step % 100 == 0) {
+            std::string error = verify("after a random step");
+            if (!error.empty()) return error;
+        }
+    }
+    std::unique_ptr<Scene> shard = Scene::createShard();
+    for (int i = 0; i < 100; ++i) {
+        live.push_back(make());
+        shard->addObject(live.back().obj);
+    }
+    scene->merge(*shard);
+    if (shard->stats().objects != 0) return "merge: shard statistics not cleared";
+    return verify("after merge");
+}
+
+// ====================== 7. Making Facade ======================
+class GraphicsFacade {
+    AbstractGraphFactory* factory;
+    TraceRecorder* recorder = nullptr;
+
+    // Comma-separated list of numbers up to the end of the command
+    static std::vector<double> readNumbers(std::istream& in) {
+        std::vector<double> values;
+        double v; char comma;
+        while (in >> v) {
+            values.push_back(v);
+            if (!(in >> comma)) break;
+        }
+        return values;
+    }
+    static double secondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    static void countBuild(std::chrono::steady_clock::time_point start, size_t bytes, size_t objects) {
+        Metrics* m = Metrics::getInstance();
+        m->add(Metrics::BuildCalls);
+        m->add(Metrics::ParseBytes, bytes);
+        m->add(Metrics::ObjectsBuilt, objects);
+        m->observe(Metrics::BuildSeconds, secondsSince(start));
+    }
+    void countExport(TraceKind kind, std::chrono::steady_clock::time_point start, unsigned threads) const {
+        auto end = std::chrono::steady_clock::now();
+        Metrics::getInstance()->add(Metrics::ExportCalls);
+        Metrics::getInstance()->observe(Metrics::ExportSeconds, std::chrono::duration<double>(end - start).count());
+        if (recorder) recorder->recordExport(kind, start, end, threads);
+    }
+    void record(TraceKind kind, std::chrono::steady_clock::time_point start, const std::string& command) const {
+        if (recorder) recorder->recordText(kind, start, std::chrono::steady_clock::now(), command);
+    }
+public:
+    GraphicsFacade(AbstractGraphFactory* f) : factory(f) {}
+
+    // Logs every following build, query and export call; nullptr stops recording
+    void setRecorder(TraceRecorder* r) { recorder = r; }
+
+    // Scene the factory builds into; the global one unless the factory targets a shard
+    Scene* scene() const { return factory->targetScene(); }
+
+    void exportSvg(std::ostream& out, unsigned threads = 1) const {
+        auto start = std::chrono::steady_clock::now();
+        ::exportSvg(*scene(), out, threads);
+        countExport(TraceKind::ExportSvg, start, threads);
+    }
+    void exportJson(std::ostream& out, unsigned threads = 1) const {
+        auto start = std::chrono::steady_clock::now();
+        ::exportJson(*scene(), out, threads);
+        countExport(TraceKind::ExportJson, start, threads);
+    }
+    // Number of shapes (through groups and decorators) whose bounds intersect region
+    size_t countInRegion(const Bounds& region) const {
+        auto start = std::chrono::steady_clock::now();
+        size_t n = 0;
+        for (const FlatItem& it : scene()->flat().where(inRegion(region))) { (void)it; ++n; }
+        if (recorder) recorder->recordQuery(start, std::chrono::steady_clock::now(), region);
+        return n;
+    }
+
+    // Lazy mode: only indexes the commands, objects are built when first touched
+    LazyCommandBlock* buildSceneLazy(const std::string& command) {
+        auto start = std::chrono::steady_clock::now();
+        scene()->clear();
+        LazyCommandBlock* block = LazyCommandBlock::index(std::make_shared<const std::string>(command), true);
+        scene()->addObject(block);
+        countBuild(start, command.size(), 0);
+        record(TraceKind::BuildLazy, start, command);
+        return block;
+    }
+
+    void buildSceneFromString(const std::string& command) {
+        auto start = std::chrono::steady_clock::now();
+        scene()->clear();
+        std::istringstream iss(command);
+        std::string token;
+        GraphObject* pendingShape = nullptr;    // triangle or polygon waiting for a possible F
+
+        while (std::getline(iss, token, ';')) {
+            token.erase(0, token.find_first_not_of(" \t"));
+            if (token.empty()) continue;
+
+            std::istringstream tss(token);
+            char type;
+            tss >> type;
+
+            if (type == 'P' || type == 'p') {       // Point
+                double x, y; char comma;
+                tss >> x >> comma >> y;
+                factory->createPoint(x, y);
+            }
+            else if (type == 'C' || type == 'c') {  // Circle
+                double cx, cy, r; char c1, c2;
+                tss >> cx >> c1 >> cy >> c2 >> r;
+                factory->createCircle(cx, cy, r);
+            }
+            else if (type == 'T' || type == 't') {  // Triangle
+                double x1,y1,x2,y2,x3,y3; char c1,c2,c3,c4,c5;
+                tss >> x1 >> c1 >> y1 >> c2 >> x2 >> c3 >> y2 >> c4 >> x3 >> c5 >> y3;
+                if (pendingShape) scene()->addObject(pendingShape);
+                pendingShape = new TriangleAdapter(x1,y1,x2,y2,x3,y3,true);
+            }
+            else if (type == 'L' || type == 'l') {  // Polyline: L x1,y1,x2,y2,...
+                factory->createPolyline(readNumbers(tss));
+            }
+            else if (type == 'G' || type == 'g') {  // Polygon: G x1,y1,x2,y2,...
+                if (pendingShape) scene()->addObject(pendingShape);
+                pendingShape = new Polygon(readNumbers(tss), true);
+            }
+            else if (type == 'M' || type == 'm') {  // Mesh: M x1,y1,...,x3,y3,... (6 numbers per triangle)
+                std::vector<double> coords = readNumbers(tss);
+                if (pendingShape) scene()->addObject(pendingShape);
+                pendingShape = TriangleMesh::weld(coords.data(), coords.size() / 6, 1e-9, true);
+            }
+            else if (type == 'I' || type == 'i') {  // Instance of a registered template: I name[,dx,dy]
+                std::string name;
+                double dx = 0, dy = 0; char comma;
+                std::getline(tss >> std::ws, name, ',');
+                name.erase(name.find_last_not_of(" \t") + 1);
+                tss >> dx >> comma >> dy;
+                PrototypeRegistry::getInstance()->instantiate(name, scene(), dx, dy);
+            }
+            else if (type == 'Z' || type == 'z') {  // Draw order: Z layer,z or Z z; same target as F, else the last object
+                std::vector<double> v = readNumbers(tss);
+                GraphObject* target = pendingShape ? pendingShape : scene()->lastAdded();
+                if (target && !v.empty()) {
+                    int layer = v.size() > 1 ? GraphObject::depthValue(v[0]) : target->getLayer();
+                    int z = GraphObject::depthValue(v.back());
+                    if (pendingShape) pendingShape->setDepth(layer, z);
+                    else scene()->setDepth(target, layer, z);
+                }
+            }
+            else if (type == 'F' || type == 'f') {  // Color filling for the triangle or polygon
+                if (pendingShape) {
+                    GraphObject* filled = new FilledDecorator(pendingShape);
+                    scene()->addObject(filled);
+                    pendingShape = nullptr;
+                }
+            }
+        }
+
+        // If there is no F — regular triangle or polygon
+        if (pendingShape) {
+            scene()->addObject(pendingShape);
+        }
+        countBuild(start, command.size(), scene()->size());
+        record(TraceKind::Build, start, command);
+    }
+};
+
+// ====================== Lazy build self-check ======================
+// Builds each command string eagerly and lazily and compares the SVG exports. Covers pending
+// T/G/M with later P/C/L, F and Z targets, template instances and out-of-range Z values.
+// Returns an empty string when all match, otherwise the first string that differs.
+inline std::string checkLazyMatchesEager() {
+    Composite proto;
+    proto.add(new Circle(1, 1, 1));
+    proto.add(new FilledDecorator(new TriangleAdapter(0, 0, 2, 0, 0, 2, true)));
+    GraphObject* top = new Point(3, 3);
+    top->setDepth(2, 1);
+    proto.add(top);
+    PrototypeRegistry::getInstance()->registerTemplate("lazy-check", proto);
+    const char* cases[] = {
+        "T 0,0,10,0,0,10; P 5,5; F",
+        "T 0,0,10,0,0,10; P 5,5",
+        "T 0,0,10,0,0,10; P 5,5; Z 3",
+        "G 0,0,4,0,4,4; M 0,0,1,0,0,1,5,5,6,5,5,6; F; Z 1,1; L 0,0,3,3; Z 2; T 1,1,2,1,1,2",
+        "C 1,1,1; Z 40000; P 2,2; Z -1e300,5; C 3,3,3; Z 1e10",
+        "I lazy-check,2,3; C 0,0,1",
+        "I lazy-check; Z 7; T 0,0,1,0,0,1; I lazy-check,4,4; F",
+        "C 1,1,1; I no-such-template; Z 2",
+        "C 1,1,1; Z 2,0; P 2,2; C 3,3,3; Z 1; T 0,0,1,0,0,1; F; Z 5,5; L 0,0,9,9",
+    };
+    for (const char* text : cases) {
+        std::unique_ptr<Scene> eager = Scene::createShard(), lazy = Scene::createShard();
+        ColorGraphFactory eagerFactory(eager.get()), lazyFactory(lazy.get());
+        GraphicsFacade(&eagerFactory).buildSceneFromString(text);
+        GraphicsFacade(&lazyFactory).buildSceneLazy(text);
+        std::ostringstream a, b;
+        exportSvg(*eager, a);
+        exportSvg(*lazy, b);
+        if (a.str() != b.str()) return std::string("lazy build differs: ") + text;
+    }
+    return std::string();
+}
+
+// ====================== Facade call trace: replay ======================
+// Loads a trace written by TraceRecorder and re-issues its calls against a facade, keeping the
+// recorded spacing scaled by speed (1 = original pace, 2 = twice as fast, 0 = back to back)
+class TraceReplayer {
+    struct Call {
+        TraceKind kind;
+        int64_t startMicros;
+        uint64_t durationMicros;
+        size_t text = 0;        // index into strings for builds
+        unsigned threads = 1;
+        Bounds region;
+    };
+    std::vector<std::string> strings;
+    std::vector<Call> calls;
+
+    // Export output is only counted
+    class CountingBuffer : public std::streambuf {
+    public:
+        size_t bytes = 0;
+    protected:
+        int_type overflow(int_type ch) override { if (ch != traits_type::eof()) ++bytes; return ch; }
+        std::streamsize xsputn(const char*, std::streamsize n) override { bytes += size_t(n); return n; }
+    };
+    static bool varint(std::istream& in, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int c = in.get();
+            if (c == EOF) return false;
+            v |= uint64_t(c & 0x7f) << shift;
+            if (!(c & 0x80)) return true;
+        }
+        return false;
+    }
+    static const char* kindName(TraceKind k) {
+        switch (k) {
+            case TraceKind::Build: return "build";
+            case TraceKind::BuildLazy: return "build_lazy";
+            case TraceKind::Query: return "query";
+            case TraceKind::ExportSvg: return "export_svg";
+            case TraceKind::ExportJson: return "export_json";
+        }
+        return "?";
+    }
+public:
+    // False on a foreign or truncated file; calls read up to the damage are kept
+    bool load(std::istream& in) {
+        strings.clear();
+        calls.clear();
+        char magic[sizeof(TraceRecorder::kMagic)];
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, TraceRecorder::kMagic, sizeof(magic)) != 0) return false;
+        int64_t start = 0;
+        for (int kind; (kind = in.get()) != EOF; ) {
+            Call c;
+            c.kind = TraceKind(kind);
+            uint64_t delta, value;
+            if (!varint(in, delta) || !varint(in, c.durationMicros)) return false;
+            start += int64_t(delta >> 1) ^ -int64_t(delta & 1);
+            c.startMicros = start;
+            switch (c.kind) {
+                case TraceKind::Build:
+                case TraceKind::BuildLazy:
+                    if (!varint(in, value)) return false;
+                    if (value == 0) {
+                        uint64_t length;
+                        if (!varint(in, length)) return false;
+                        std::string text(length, '\0');
+                        if (!in.read(&text[0], std::streamsize(length))) return false;
+                        c.text = strings.size();
+                        strings.push_back(std::move(text));
+                    } else {
+                        if (value > strings.size()) return false;
+                        c.text = size_t(value - 1);
+                    }
+                    break;
+                case TraceKind::Query: {
+                    double v[4];
+                    if (!in.read(reinterpret_cast<char*>(v), sizeof(v))) return false;
+                    c.region = Bounds(v[0], v[1], v[2], v[3]);
+                    break;
+                }
+                case TraceKind::ExportSvg:
+                case TraceKind::ExportJson:
+                    if (!varint(in, value)) return false;
+                    c.threads = unsigned(value);
+                    break;
+                default:
+                    return false;
+            }
+            calls.push_back(std::move(c));
+        }
+        return true;
+    }
+    size_t size() const { return calls.size(); }
+
+    // Replays every call and prints throughput plus per-kind latency next to the recorded one
+    void replay(GraphicsFacade& facade, double speed = 0, std::ostream& report = std::cout) const {
+        struct Latencies { std::vector<double> replayed; double recorded = 0; };
+        std::map<TraceKind, Latencies> byKind;
+        CountingBuffer sink;
+        std::ostream exportOut(&sink);
+        size_t parsedBytes = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (const Call& c : calls) {
+            if (speed > 0) {
+                auto due = begin + std::chrono::microseconds(int64_t(double(c.startMicros - calls.front().startMicros) / speed));
+                std::this_thread::sleep_until(due);
+            }
+            auto start = std::chrono::steady_clock::now();
+            switch (c.kind) {
+                case TraceKind::Build: facade.buildSceneFromString(strings[c.text]); parsedBytes += strings[c.text].size(); break;
+                case TraceKind::BuildLazy: facade.buildSceneLazy(strings[c.text]); parsedBytes += strings[c.text].size(); break;
+                case TraceKind::Query: facade.countInRegion(c.region); break;
+                case TraceKind::ExportSvg: facade.exportSvg(exportOut, c.threads); break;
+                case TraceKind::ExportJson: facade.exportJson(exportOut, c.threads); break;
+            }
+            Latencies& l = byKind[c.kind];
+            l.replayed.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            l.recorded += double(c.durationMicros) * 1e-6;
+        }
+        double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        report << calls.size() << " calls in " << total * 1e3 << " ms: " << double(calls.size()) / std::max(total, 1e-9)
+               << " calls/s, parse " << double(parsedBytes) / 1e6 / std::max(total, 1e-9) << " MB/s, export "
+               << double(sink.bytes) / 1e6 / std::max(total, 1e-9) << " MB/s\n";
+        for (auto& entry : byKind) {
+            std::vector<double>& v = entry.second.replayed;
+            std::sort(v.begin(), v.end());
+            double mean = std::accumulate(v.begin(), v.end(), 0.0) / double(v.size());
+            auto pct = [&](double q) { return v[std::min(v.size() - 1, size_t(q * double(v.size())))] * 1e3; };
+            report << kindName(entry.first) << ": " << v.size() << " calls, mean " << mean * 1e3 << " ms, p50 " << pct(0.5)
+                   << " ms, p99 " << pct(0.99) << " ms, max " << v.back() * 1e3 << " ms (recorded mean "
+                   << entry.second.recorded / double(v.size()) * 1e3 << " ms)\n";
+        }
+    }
+};
+
+// ====================== Sampling profiler ======================
+// In-process CPU profiler: ITIMER_PROF fires SIGPROF at the requested rate and the handler stores
+// the raw return addresses into a preallocated buffer. Names are resolved only when the profile
+// is written, as folded stacks ("main;build;parse 42") for flamegraph.pl or speedscope.
+// The handler walks saved frame pointers (backtrace() is not async-signal-safe), so build with
+// -fno-omit-frame-pointer for full stacks; code without them shows up as truncated stacks.
+// Link with -rdynamic to get names for functions of the executable itself.
+class SamplingProfiler {
+    static constexpr int kMaxDepth = 48;
+    static constexpr size_t kMaxFrameStep = 1 << 20;   // larger jumps are treated as a broken chain
+    struct Sample {
+        std::atomic<int> depth{0};          // published last; 0 while being written
+        void* pcs[kMaxDepth];
+    };
+    static SamplingProfiler* instance;
+    std::unique_ptr<Sample[]> samples;
+    size_t capacity = 0;
+    std::atomic<size_t> next{0}, dropped{0};
+    std::atomic<bool> running{false};
+    std::atomic<int> inHandler{0};          // stop() waits for this to drain before buffers may change
+    bool installed = false;
+
+    SamplingProfiler() = default;
+#ifdef __linux__
+    // Interrupted pc, then return addresses along the frame-pointer chain. Each step must move up
+    // the stack by a small aligned amount, which stops the walk at frames built without a frame pointer.
+    static int walkStack(const void* context, void** pcs) {
+        const ucontext_t* uc = static_cast<const ucontext_t*>(context);
+#if defined(__x86_64__)
+        uintptr_t pc = uintptr_t(uc->uc_mcontext.gregs[REG_RIP]);
+        uintptr_t sp = uintptr_t(uc->uc_mcontext.gregs[REG_RSP]);
+        uintptr_t fp = uintptr_t(uc->uc_mcontext.gregs[REG_RBP]);
+#elif defined(__aarch64__)
+        uintptr_t pc = uintptr_t(uc->uc_mcontext.pc);
+        uintptr_t sp = uintptr_t(uc->uc_mcontext.sp);
+        uintptr_t fp = uintptr_t(uc->uc_mcontext.regs[29]);
+#else
+        (void)uc; (void)pcs;
+        return 0;
+#endif
+#if defined(__x86_64__) || defined(__aarch64__)
+        int depth = 0;
+        pcs[depth++] = reinterpret_cast<void*>(pc);
+        uintptr_t low = sp;
+        while (depth < kMaxDepth && fp >= low && fp - low < kMaxFrameStep && fp % sizeof(void*) == 0) {
+            const uintptr_t* frame = reinterpret_cast<const uintptr_t*>(fp);
+            uintptr_t ret = frame[1];
+            if (!ret) break;
+            pcs[depth++] = reinterpret_cast<void*>(ret);
+            low = fp + 2 * sizeof(void*);
+            fp = frame[0];
+        }
+        return depth;
+#endif
+    }
+    static void onSignal(int, siginfo_t*, void* context) {
+        SamplingProfiler* p = instance;
+        if (!p) return;
+        p->inHandler.fetch_add(1);
+        if (p->running.load()) {
+            int savedErrno = errno;
+            size_t i = p->next.fetch_add(1, std::memory_order_relaxed);
+            if (i < p->capacity) {
+                Sample& s = p->samples[i];
+                s.depth.store(walkStack(context, s.pcs), std::memory_order_release);
+            } else {
+                p->dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            errno = savedErrno;
+        }
+        p->inHandler.fetch_sub(1, std::memory_order_release);
+    }
+    static void setTimer(int hz) {
+        itimerval timer{};
+        if (hz > 0) {
+            timer.it_interval.tv_usec = std::max(1, 1000000 / hz);
+            timer.it_value = timer.it_interval;
+        }
+        setitimer(ITIMER_PROF, &timer, nullptr);
+    }
+    static std::string symbolize(void* pc) {
+        Dl_info info{};
+        char buf[64];
+        if (!dladdr(pc, &info)) {
+            std::snprintf(buf, sizeof(buf), "%p", pc);
+            return buf;
+        }
+        if (info.dli_sname) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            std::string name = status == 0 && demangled ? demangled : info.dli_sname;
+            std::free(demangled);
+            std::replace(name.begin(), name.end(), ';', ':');
+            return name;
+        }
+        const char* module = info.dli_fname ? std::strrchr(info.dli_fname, '/') : nullptr;
+        module = module ? module + 1 : (info.dli_fname ? info.dli_fname : "?");
+        std::snprintf(buf, sizeof(buf), "+0x%zx", size_t(static_cast<char*>(pc) - static_cast<char*>(info.dli_fbase)));
+        return module + std::string(buf);
+    }
+#endif
+public:
+    static SamplingProfiler* getInstance() {
+        if (!instance) instance = new SamplingProfiler();
+        return instance;
+    }
+    SamplingProfiler(const SamplingProfiler&) = delete;
+    SamplingProfiler& operator=(const SamplingProfiler&) = delete;
+
+#ifdef __linux__
+    static constexpr bool available() { return true; }
+#else
+    static constexpr bool available() { return false; }
+#endif
+    bool isRunning() const { return running.load(std::memory_order_relaxed); }
+    size_t sampleCount() const { return std::min(next.load(std::memory_order_relaxed), capacity); }
+    size_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+    // Starts sampling at hz; up to maxSamples are kept until reset(). Samples of an earlier run
+    // are kept, so start/stop can bracket just the interesting phases.
+    bool start(int hz = 99, size_t maxSamples = 16384) {
+#ifdef __linux__
+        if (isRunning() || hz <= 0) return false;
+        if (!samples || maxSamples != capacity) {      // no handler is inside: see stop()
+            samples.reset(new Sample[maxSamples]);
+            capacity = maxSamples;
+            next = 0;
+            dropped = 0;
+        }
+        if (!installed) {
+            struct sigaction action{};
+            action.sa_sigaction = &SamplingProfiler::onSignal;
+            action.sa_flags = SA_RESTART | SA_SIGINFO;
+            sigemptyset(&action.sa_mask);
+            if (sigaction(SIGPROF, &action, nullptr) != 0) return false;
+            installed = true;
+        }
+        running.store(true, std::memory_order_release);
+        setTimer(hz);
+        return true;
+#else
+        (void)hz; (void)maxSamples;
+        return false;
+#endif
+    }
+    // Returns once no handler is still writing, so start() and reset() may touch the buffer
+    void stop() {
+#ifdef __linux__
+        setTimer(0);
+#endif
+        running.store(false);
+        while (inHandler.load(std::memory_order_acquire) != 0) std::this_thread::yield();
+    }
+    // Drops collected samples; only while stopped
+    void reset() {
+        if (isRunning() || !samples) return;
+        for (size_t i = 0; i < capacity; ++i) samples[i].depth.store(0, std::memory_order_relaxed);
+        next = 0;
+        dropped = 0;
+    }
+
+    // One line per distinct stack, root first, with its sample count
+    void writeFolded(std::ostream& out) const {
+#ifdef __linux__
+        std::unordered_map<void*, std::string> names;
+        std::map<std::string, size_t> stacks;
+        std::string line;
+        for (size_t i = 0; i < sampleCount(); ++i) {
+            const Sample& s = samples[i];
+            int depth = s.depth.load(std::memory_order_acquire);
+            if (depth <= 0) continue;
+            line.clear();
+            for (int f = depth - 1; f >= 0; --f) {
+                // return addresses point past the call; the interrupted frame is exact
+                void* pc = f == 0 ? s.pcs[f] : static_cast<char*>(s.pcs[f]) - 1;
+                auto it = names.find(pc);
+                if (it == names.end()) it = names.emplace(pc, symbolize(pc)).first;
+                if (!line.empty()) line += ';';
+                line += it->second;
+            }
+            ++stacks[line];
+        }
+        for (const auto& st : stacks) out << st.first << ' ' << st.second << '\n';
+#else
+        (void)out;
+#endif
+    }
+    bool writeFolded(const std::string& path) const {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) return false;
+        writeFolded(out);
+        return bool(out);
+    }
+};
+SamplingProfiler* SamplingProfiler::instance = nullptr;
+
+// Times a parse benchmark (facade build of a generated command string) and a draw benchmark
+// (raster of that scene) without the profiler and with it at each rate
+inline void reportProfilerOverhead(size_t commands = 200000, const std::vector<int>& rates = {99, 999},
+                                   std::ostream& out = std::cout) {
+    std::string text;
+    for (size_t i = 0; i < commands; ++i) {
+        double x = double(i % 1000), y = double(i / 1000 % 1000);
+        switch (i % 4) {
+            case 0: text += "P " + std::to_string(x) + "," + std::to_string(y) + "; "; break;
+            case 1: text += "C " + std::to_string(x) + "," + std::to_string(y) + ",3; "; break;
+            case 2: text += "T " + std::to_string(x) + "," + std::to_string(y) + "," + std::to_string(x + 4) + ","
+                          + std::to_string(y) + "," + std::to_string(x) + "," + std::to_string(y + 4) + "; F; "; break;
+            default: text += "L " + std::to_string(x) + "," + std::to_string(y) + "," + std::to_string(x + 8) + ","
+                           + std::to_string(y + 2) + "; "; break;
+        }
+    }
+    std::unique_ptr<Scene> shard = Scene::createShard();
+    ColorGraphFactory factory(shard.get());
+    GraphicsFacade facade(&factory);
+    auto timed = [](const std::function<void()>& f) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    auto parse = [&] { facade.buildSceneFromString(text); };
+    auto draw = [&] { Raster raster(512, 512, shard->bounds()); shard->emitAll(raster); };
+    SamplingProfiler* profiler = SamplingProfiler::getInstance();
+    parse(); draw();    // warm-up
+    double baseParse = timed(parse), baseDraw = timed(draw);
+    out << "profiler off: parse " << baseParse * 1e3 << " ms, draw " << baseDraw * 1e3 << " ms\n";
+    for (int hz : rates) {
+        profiler->reset();      // count only this rate's samples
+        if (!profiler->start(hz)) { out << "profiler unavailable\n"; return; }
+        double p = timed(parse), d = timed(draw);
+        profiler->stop();
+        out << hz << " Hz: parse " << p * 1e3 << " ms (" << (p / baseParse - 1) * 100 << "%), draw "
+            << d * 1e3 << " ms (" << (d / baseDraw - 1) * 100 << "%), " << profiler->sampleCount() << " samples\n";
+    }
+}
+
+// ====================== main ======================
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    // "--self-check" runs the randomized consistency checks instead of the demo
+    if (argc > 1 && std::strcmp(argv[1], "--self-check") == 0) {
+        std::string statsError = checkSceneStats(), lazyError = checkLazyMatchesEager();
+        std::cout << "Scene statistics check: " << (statsError.empty() ? "ok" : statsError) << "\n";
+        std::cout << "Lazy build check: " << (lazyError.empty() ? "ok" : lazyError) << "\n";
+        return statsError.empty() && lazyError.empty() ? 0 : 1;
+    }
+
+    ColorGraphFactory colorFactory;
+    GraphicsFacade facade(&colorFactory);
+
+    // Facade demonstration
+    std::string command = "P 10,20; C 50,50,25; T 0,0,100,0,50,80; F";
+    std::cout << "Facade query-string: " << command << "\n\n";
+    facade.buildSceneFromString(command);
+    Scene::getInstance()->drawAll();
+
+    // === Composite demonstration ===
+    std::cout << "=== Composite demonstration ===\n";
+    Composite* group = new Composite();
+    group->add(new Point(1,1,true));
+    group->add(new Circle(5,5,10,true));
+    group->draw();
+    delete group;
+
+    // === Batch adapter demonstration ===
+    std::cout << "\n=== Batch adapter demonstration ===\n";
+    std::vector<ThirdPartyTriangle> external = { {0,0,10,0,5,8}, {10,0,20,0,15,8} };
+    TriangleBatchAdapter batch(external.data(), external.size());
+    batch.draw();
+    Bounds b = batch.bounds();
+    std::cout << "Bounds: (" << b.minX << "," << b.minY << ")-(" << b.maxX << "," << b.maxY << ")\n";
+
+    // === Prototype registry demonstration ===
+    std::cout << "\n=== Prototype registry demonstration ===\n";
+    Composite house;
+    house.add(new FilledDecorator(new TriangleAdapter(0,10,20,10,10,0,true)));
+    house.add(new Line(0,10,0,30,true));
+    house.add(new Line(20,10,20,30,true));
+    PrototypeRegistry::getInstance()->registerTemplate("house", house);
+    facade.buildSceneFromString("I house; I house,100,0");
+    Scene::getInstance()->drawAll();
+
+    // === Scene ranges demonstration ===
+    const Scene& scene = *Scene::getInstance();
+    size_t memory = std::transform_reduce(scene.begin(), scene.end(), size_t(0), std::plus<>(),
+                                          [](const GraphObject* g) { return g->memorySize(); });
+    size_t filled = std::count_if(scene.flat().begin(), scene.flat().end(),
+                                  [](const FlatItem& it) { return it.filled; });
+    std::cout << "Top-level memory: " << memory << " bytes, filled leaves: " << filled << "\n";
+
+    // === Lazy filtered traversal: stops at the first match, later commands are never built ===
+    LazyCommandBlock* lazy = facade.buildSceneLazy("C 5,5,2; T 0,0,4,0,2,3; F; C 40,40,3; P 1,1; C 90,90,1");
+    for (const FlatItem& it : scene.flat().where(ofType<Circle>()).where(inRegion(Bounds(30, 30, 50, 50)))) {
+        it.object->draw();
+        break;
+    }
+    std::cout << "Built " << lazy->materializedCount() << " of " << lazy->childCount() << " commands\n";
+
+    return a.exec();
+}